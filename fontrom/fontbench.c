@@ -0,0 +1,384 @@
+/*
+ * fontbench.c
+ *
+ *  Benchmark the font rom tools on deterministic synthetic corpora.
+ *
+ *  usage: fontbench [-n images] [-r rounds] [-s seed] [-w dir]
+ *         fontbench -c [-s seed]
+ *
+ *  -n  images per corpus (default 1000)
+ *  -r  rounds over each corpus (default 3)
+ *  -s  seed for the corpus generator (default 1)
+ *  -w  also write the corpora to dir/<size>/NNNNN.bin, e.g. for timing
+ *      "reversebits -o out dir/2048"
+ *
+ *  There is one corpus each of 2 KB, 4 KB and 32 KB images. The convert
+ *  and unfix paths are timed with every permutation backend; render,
+ *  atlas and diff do not depend on the backend. Each result is printed as
+ *  one JSON object per line:
+ *
+ *  {"path":"convert","backend":"swar","image_bytes":2048,"images":1000,
+ *   "rounds":3,"mb_per_s":...,"images_per_s":...,"p50_ns":...,"p99_ns":...}
+ *
+ *  Latencies are per image call.
+ *
+ *  -c checks every permutation backend against fixBits() and unfixBits()
+ *  instead: all 256 byte values, then random buffers of every length from
+ *  1 to 257 bytes at every alignment from 0 to 7, making sure the bytes
+ *  around each buffer are left alone. One JSON line per backend and
+ *  direction gives the failure count and cycles per byte (nanoseconds per
+ *  byte where there is no cycle counter). Exit status is 1 on failure.
+ *
+ *  build: cc -O2 -o fontbench fontbench.c
+ */
+
+#include <stdio.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "fontrom.h"
+
+typedef struct
+{
+    size_t          image_bytes;
+    size_t          images;
+    unsigned char  *data;       // images back to back
+    unsigned char  *copy;       // scratch for paths that modify images
+    unsigned char  *mutated;    // data with a few bits flipped, for diff
+} corpus_t;
+
+typedef enum
+{
+    PATH_CONVERT,
+    PATH_UNFIX,
+    PATH_RENDER,
+    PATH_ATLAS,
+    PATH_DIFF
+} path_t;
+
+static const char *path_name[] = { "convert", "unfix", "render", "atlas", "diff" };
+static const char *backend_name[] = { "scalar", "table", "swar" };
+
+static const size_t corpus_sizes[] = { 2048, 4096, 32768 };
+
+static FILE *null_out;
+
+static uint64_t xorshift(uint64_t *state)
+{
+    uint64_t x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+
+    return *state = x;
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * make_corpus()
+ *
+ *  Glyph-like images: pixels only in the 5 middle columns, a top blank
+ *  row and a flash/inverse bit that is the same on every row of a glyph.
+ *  The mutated copy has one bit flipped in every 16th glyph.
+ */
+static int make_corpus(corpus_t *c, size_t image_bytes, size_t images, uint64_t seed)
+{
+    size_t   total = image_bytes * images, i;
+    uint64_t state = seed * 0x9e3779b97f4a7c15ULL + image_bytes;
+    glyph_t  g;
+
+    c->image_bytes = image_bytes;
+    c->images = images;
+    c->data = malloc(total);
+    c->copy = malloc(total);
+    c->mutated = malloc(total);
+    if (c->data == NULL || c->copy == NULL || c->mutated == NULL)
+        return -1;
+
+    for (i = 0; i < total / GLYPH_ROWS; i++) {
+        g = xorshift(&state) & BYTES(0x3e) & ~(glyph_t)0xff;
+        if (xorshift(&state) & 1)
+            g |= BYTES(0x80);
+        font_put_glyph(c->data, i, g);
+        if (i % 16 == 0)
+            g ^= (glyph_t)1 << (xorshift(&state) % 64);
+        font_put_glyph(c->mutated, i, g);
+    }
+
+    return 0;
+}
+
+static void free_corpus(corpus_t *c)
+{
+    free(c->data);
+    free(c->copy);
+    free(c->mutated);
+}
+
+static int write_corpus(const corpus_t *c, const char *dir)
+{
+    char   name[4096];
+    FILE  *out;
+    size_t i;
+
+    mkdir(dir, 0777);
+    snprintf(name, sizeof(name), "%s/%zu", dir, c->image_bytes);
+    if (mkdir(name, 0777) < 0 && access(name, W_OK) < 0) {
+        perror(name);
+        return -1;
+    }
+
+    for (i = 0; i < c->images; i++) {
+        snprintf(name, sizeof(name), "%s/%zu/%05zu.bin", dir, c->image_bytes, i);
+        if ((out = fopen(name, "wb")) == NULL ||
+            fwrite(c->data + i * c->image_bytes, 1, c->image_bytes, out) != c->image_bytes ||
+            fclose(out) != 0) {
+            perror(name);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static void run_one(corpus_t *c, path_t path, perm_backend_t backend, size_t i)
+{
+    unsigned char *img = c->data + i * c->image_bytes;
+    unsigned char *copy = c->copy + i * c->image_bytes;
+
+    switch (path) {
+        case PATH_CONVERT:
+            perm_buf(copy, c->image_bytes, PERM_FIX, backend);
+            break;
+        case PATH_UNFIX:
+            perm_buf(copy, c->image_bytes, PERM_UNFIX, backend);
+            break;
+        case PATH_RENDER:
+            font_render(null_out, img, c->image_bytes, ORDER_GTAC);
+            break;
+        case PATH_ATLAS:
+            font_atlas(null_out, img, c->image_bytes / GLYPH_ROWS, ORDER_GTAC);
+            break;
+        case PATH_DIFF:
+            font_diff(null_out, "ref", img, c->image_bytes,
+                      "test", c->mutated + i * c->image_bytes, c->image_bytes,
+                      ORDER_GTAC, 1);
+            break;
+    }
+}
+
+static int bench(corpus_t *c, path_t path, perm_backend_t backend, int rounds)
+{
+    size_t    samples = c->images * rounds, i, n = 0;
+    uint64_t *ns, total = 0, t;
+    int       r;
+
+    if ((ns = malloc(samples * sizeof(*ns))) == NULL)
+        return -1;
+
+    for (r = 0; r < rounds; r++) {
+        memcpy(c->copy, c->data, c->image_bytes * c->images);
+        for (i = 0; i < c->images; i++) {
+            t = now_ns();
+            run_one(c, path, backend, i);
+            ns[n] = now_ns() - t;
+            total += ns[n++];
+        }
+    }
+    fflush(null_out);
+
+    qsort(ns, samples, sizeof(*ns), compare_u64);
+    if (total == 0)
+        total = 1;
+
+    printf("{\"path\":\"%s\",\"backend\":\"%s\",\"image_bytes\":%zu,\"images\":%zu,"
+           "\"rounds\":%d,\"mb_per_s\":%.1f,\"images_per_s\":%.0f,"
+           "\"p50_ns\":%llu,\"p99_ns\":%llu}\n",
+           path_name[path], path <= PATH_UNFIX ? backend_name[backend] : "none",
+           c->image_bytes, c->images, rounds,
+           (double)c->image_bytes * samples * 1000.0 / total,
+           (double)samples * 1e9 / total,
+           (unsigned long long)ns[samples / 2],
+           (unsigned long long)ns[samples * 99 / 100]);
+    fflush(stdout);
+
+    free(ns);
+    return 0;
+}
+
+#define CHECK_MAX_LEN   257
+#define CHECK_GUARD     16
+#define CHECK_ROUNDS    64
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CYCLE_UNIT      "cycles_per_byte"
+static uint64_t cycles(void) { return __rdtsc(); }
+#else
+#define CYCLE_UNIT      "ns_per_byte"
+static uint64_t cycles(void) { return now_ns(); }
+#endif
+
+static unsigned char reference(perm_dir_t dir, unsigned char b)
+{
+    return (unsigned char)(dir == PERM_FIX ? fixBits(b) : unfixBits(b));
+}
+
+/*
+ * check_backend()
+ *
+ *  Compare one backend and direction with the reference functions.
+ *  Returns the number of wrong bytes.
+ */
+static size_t check_backend(perm_dir_t dir, perm_backend_t backend, uint64_t seed)
+{
+    unsigned char buf[CHECK_GUARD + 8 + CHECK_MAX_LEN + CHECK_GUARD];
+    unsigned char want[sizeof(buf)];
+    uint64_t      state = seed | 1, t, spent = 0, bytes = 0;
+    size_t        failures = 0, cases = 0, len, align, i;
+    int           r;
+
+    // every byte value, in one buffer
+    for (i = 0; i < 256; i++)
+        buf[i] = (unsigned char)i;
+    perm_buf(buf, 256, dir, backend);
+    for (i = 0; i < 256; i++)
+        if (buf[i] != reference(dir, (unsigned char)i))
+            failures++;
+    cases++;
+
+    // random buffers of odd lengths and alignments with guard bytes around
+    for (r = 0; r < CHECK_ROUNDS; r++) {
+        for (len = 1; len <= CHECK_MAX_LEN; len++) {
+            for (align = 0; align < 8; align++) {
+                for (i = 0; i < sizeof(buf); i++)
+                    buf[i] = (unsigned char)xorshift(&state);
+                for (i = 0; i < sizeof(buf); i++) {
+                    if (i >= CHECK_GUARD + align && i < CHECK_GUARD + align + len)
+                        want[i] = reference(dir, buf[i]);
+                    else
+                        want[i] = buf[i];
+                }
+
+                t = cycles();
+                perm_buf(buf + CHECK_GUARD + align, len, dir, backend);
+                spent += cycles() - t;
+                bytes += len;
+
+                for (i = 0; i < sizeof(buf); i++)
+                    if (buf[i] != want[i])
+                        failures++;
+                cases++;
+            }
+        }
+    }
+
+    printf("{\"check\":\"%s\",\"backend\":\"%s\",\"cases\":%zu,\"failures\":%zu,"
+           "\"" CYCLE_UNIT "\":%.2f}\n",
+           dir == PERM_FIX ? "fix" : "unfix", backend_name[backend],
+           cases, failures, (double)spent / bytes);
+
+    return failures;
+}
+
+static int check(uint64_t seed)
+{
+    unsigned char b;
+    size_t        failures = 0;
+    int           dir, backend, i;
+
+    // the two reference functions must be inverses of each other
+    for (i = 0; i < 256; i++) {
+        b = (unsigned char)i;
+        if (unfixBits((unsigned char)fixBits(b)) != b)
+            failures++;
+    }
+
+    for (dir = PERM_FIX; dir <= PERM_UNFIX; dir++)
+        for (backend = PERM_SCALAR; backend <= PERM_SWAR; backend++)
+            failures += check_backend((perm_dir_t)dir, (perm_backend_t)backend, seed);
+
+    if (failures)
+        fprintf(stderr, "fontbench: %zu wrong bytes\n", failures);
+
+    return failures ? 1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+    const char    *dir = NULL;
+    corpus_t       c;
+    size_t         images = 1000, s;
+    uint64_t       seed = 1;
+    int            opt, rounds = 3, path, backend, status = 0, check_only = 0;
+
+    while ((opt = getopt(argc, argv, "cn:r:s:w:")) != -1) {
+        switch (opt) {
+            case 'c': check_only = 1; break;
+            case 'n': images = strtoul(optarg, NULL, 0); break;
+            case 'r': rounds = atoi(optarg); break;
+            case 's': seed = strtoull(optarg, NULL, 0); break;
+            case 'w': dir = optarg; break;
+            default:  status = 2; break;
+        }
+    }
+
+    if (status || images == 0 || rounds < 1) {
+        fprintf(stderr, "usage: fontbench [-n images] [-r rounds] [-s seed] [-w dir]\n"
+                        "       fontbench -c [-s seed]\n");
+        return 2;
+    }
+
+    perm_init();
+
+    if (check_only)
+        return check(seed);
+
+    if ((null_out = fopen("/dev/null", "w")) == NULL) {
+        perror("/dev/null");
+        return 1;
+    }
+
+    for (s = 0; s < sizeof(corpus_sizes) / sizeof(corpus_sizes[0]); s++) {
+        if (make_corpus(&c, corpus_sizes[s], images, seed) < 0) {
+            fprintf(stderr, "fontbench: out of memory\n");
+            return 1;
+        }
+        if (dir != NULL && write_corpus(&c, dir) < 0)
+            return 1;
+
+        for (path = PATH_CONVERT; path <= PATH_DIFF; path++) {
+            for (backend = PERM_SCALAR; backend <= PERM_SWAR; backend++) {
+                if (path > PATH_UNFIX && backend != PERM_SCALAR)
+                    break;
+                if (bench(&c, (path_t)path, (perm_backend_t)backend, rounds) < 0) {
+                    fprintf(stderr, "fontbench: out of memory\n");
+                    return 1;
+                }
+            }
+        }
+
+        free_corpus(&c);
+    }
+
+    fclose(null_out);
+    return 0;
+}
@@ -0,0 +1,69 @@
+/*
+ * fontdiff.c
+ *
+ *  Compare font ROM images glyph by glyph and report which characters
+ *  differ, instead of the byte offsets given by cmp.
+ *
+ *  usage: fontdiff [-f] [-s] [-q] ref test [ref test ...]
+ *
+ *  -f  pass the reference through fixBits() first, to compare a standard
+ *      Apple image against a GTAC converted one
+ *  -s  render glyphs in standard bit order (default is GTAC order)
+ *  -q  only print a summary line per image pair
+ *
+ *  Each 8-row glyph is compared as one 64-bit word, and the number of
+ *  differing pixels is the population count of the XOR of the two words.
+ *  Exit status is 0 if all pairs match, 1 if any differ and 2 on error.
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include "fontrom.h"
+
+static int opt_fix = 0;
+static int opt_quiet = 0;
+static bit_order_t opt_order = ORDER_GTAC;
+
+int main(int argc, char **argv)
+{
+    unsigned char *ref, *test;
+    size_t         ref_len = 0, test_len = 0;
+    int            c, i, status = 0;
+
+    perm_init();
+
+    while ((c = getopt(argc, argv, "fsq")) != -1) {
+        switch (c) {
+            case 'f': opt_fix = 1; break;
+            case 's': opt_order = ORDER_STANDARD; break;
+            case 'q': opt_quiet = 1; break;
+            default:  status = 2; break;
+        }
+    }
+
+    if (status || argc - optind < 2 || (argc - optind) % 2) {
+        fprintf(stderr, "usage: fontdiff [-f] [-s] [-q] ref test [ref test ...]\n");
+        return 2;
+    }
+
+    for (i = optind; i < argc; i += 2) {
+        ref = font_load(argv[i], &ref_len);
+        test = font_load(argv[i + 1], &test_len);
+
+        if (ref == NULL || test == NULL)
+            status = 2;
+        else {
+            if (opt_fix)
+                perm_buf(ref, ref_len, PERM_FIX, PERM_SWAR);
+            if (font_diff(stdout, argv[i], ref, ref_len, argv[i + 1], test, test_len,
+                          opt_order, opt_quiet) && !status)
+                status = 1;
+        }
+
+        free(ref);
+        free(test);
+    }
+
+    return status;
+}
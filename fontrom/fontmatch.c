@@ -0,0 +1,310 @@
+/*
+ * fontmatch.c
+ *
+ *  Identify an unknown font ROM dump against a corpus of known images.
+ *
+ *  usage: fontmatch [-d dist] [-n count] [-l list] unknown known ...
+ *
+ *  -d  maximum number of differing bits for two glyphs to match (0..3,
+ *      default 2)
+ *  -n  number of candidates to print (default 5)
+ *  -l  read known image names from a file, one per line
+ *
+ *  Every glyph of every known image is indexed twice: as stored, and
+ *  passed through fixBits(). The answer is the known image and wiring
+ *  ("stored" or "gtac") sharing the most glyphs with the unknown dump.
+ *
+ *  The index is a multi-index hash: each 64-bit glyph is split into four
+ *  16-bit chunks, and each chunk position has its own hash table. Two
+ *  glyphs that differ in at most 3 bits agree exactly on at least one
+ *  chunk, so probing the four tables finds every near match, which is
+ *  then confirmed with a popcount of the XOR.
+ *
+ *  Chunks shared by many glyphs, such as two blank rows, have long chains.
+ *  A glyph within d bits differs in at most d chunks, so only the d + 1
+ *  chunks of the query with the shortest chains are probed, and an entry
+ *  found through more than one of them is confirmed only once.
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include "fontrom.h"
+
+#define CHUNKS          4
+#define CHUNK_BITS      16
+#define CHUNK_MASK      0xffff
+
+typedef struct
+{
+    glyph_t glyph;
+    int     image;              // known image index * 2 + wiring
+} entry_t;
+
+typedef struct
+{
+    int     image;
+    size_t  glyphs;             // query glyphs with a match
+    size_t  bits;               // sum of smallest distances
+} score_t;
+
+static const char *wiring_name[2] = { "stored", "gtac" };
+
+static entry_t *entries;
+static size_t   entry_count, entry_size;
+static int32_t *heads[CHUNKS];
+static int32_t *next[CHUNKS];
+static int32_t *lengths[CHUNKS];   // chain length per chunk value
+
+static const char **names;
+static int          name_count, name_size;
+
+static int add_name(const char *name)
+{
+    const char **tmp;
+
+    if (name_count == name_size) {
+        name_size = name_size ? name_size * 2 : 64;
+        tmp = realloc(names, name_size * sizeof(*names));
+        if (tmp == NULL)
+            return -1;
+        names = tmp;
+    }
+    names[name_count++] = name;
+
+    return 0;
+}
+
+static int read_list(const char *list)
+{
+    FILE *in;
+    char  line[4096];
+    char *copy;
+    int   len;
+
+    if ((in = fopen(list, "r")) == NULL) {
+        perror(list);
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), in) != NULL) {
+        len = strcspn(line, "\r\n");
+        line[len] = 0;
+        if (len == 0 || line[0] == '#')
+            continue;
+        if ((copy = strdup(line)) == NULL || add_name(copy) < 0) {
+            fclose(in);
+            return -1;
+        }
+    }
+
+    fclose(in);
+    return 0;
+}
+
+static int add_entry(glyph_t glyph, int image)
+{
+    entry_t *tmp;
+
+    if (entry_count == entry_size) {
+        entry_size = entry_size ? entry_size * 2 : 65536;
+        tmp = realloc(entries, entry_size * sizeof(*entries));
+        if (tmp == NULL)
+            return -1;
+        entries = tmp;
+    }
+    entries[entry_count].glyph = glyph;
+    entries[entry_count].image = image;
+    entry_count++;
+
+    return 0;
+}
+
+/*
+ * build_index()
+ *
+ *  Load the known images and chain every entry into the four chunk tables.
+ */
+static int build_index(void)
+{
+    unsigned char *font;
+    size_t         len, glyphs, i, j;
+    int            n, c, wiring;
+    glyph_t        glyph;
+
+    for (n = 0; n < name_count; n++) {
+        if ((font = font_load(names[n], &len)) == NULL)
+            return -1;
+
+        glyphs = font_glyphs(len);
+        for (wiring = 0; wiring < 2; wiring++) {
+            for (i = 0; i < glyphs; i++) {
+                glyph = font_glyph(font, i);
+                if (glyph != 0 && add_entry(glyph, n * 2 + wiring) < 0) {
+                    free(font);
+                    return -1;
+                }
+            }
+            for (j = 0; j < len; j++)
+                font[j] = fixBits(font[j]);
+        }
+        free(font);
+    }
+
+    for (c = 0; c < CHUNKS; c++) {
+        heads[c] = malloc((CHUNK_MASK + 1) * sizeof(int32_t));
+        next[c] = malloc((entry_count + 1) * sizeof(int32_t));
+        lengths[c] = calloc(CHUNK_MASK + 1, sizeof(int32_t));
+        if (heads[c] == NULL || next[c] == NULL || lengths[c] == NULL)
+            return -1;
+        memset(heads[c], 0xff, (CHUNK_MASK + 1) * sizeof(int32_t));
+
+        for (i = 0; i < entry_count; i++) {
+            j = (entries[i].glyph >> (c * CHUNK_BITS)) & CHUNK_MASK;
+            next[c][i] = heads[c][j];
+            heads[c][j] = (int32_t)i;
+            lengths[c][j]++;
+        }
+    }
+
+    return 0;
+}
+
+static int compare_scores(const void *a, const void *b)
+{
+    const score_t *x = a, *y = b;
+
+    if (x->glyphs != y->glyphs)
+        return x->glyphs < y->glyphs ? 1 : -1;
+    if (x->bits != y->bits)
+        return x->bits < y->bits ? -1 : 1;
+    return x->image - y->image;
+}
+
+/*
+ * match()
+ *
+ *  Score every known image and wiring against the unknown dump and print
+ *  the best candidates.
+ */
+static int match(const char *name, int max_dist, int count)
+{
+    unsigned char *font;
+    size_t         len, glyphs, queries = 0, i;
+    score_t       *scores;
+    int           *best;
+    size_t        *seen;           // query that last confirmed each entry
+    int32_t        e;
+    glyph_t        glyph;
+    unsigned       key[CHUNKS];
+    int            order[CHUNKS];
+    int            c, d, k, images = name_count * 2;
+
+    if ((font = font_load(name, &len)) == NULL)
+        return -1;
+
+    scores = calloc(images, sizeof(*scores));
+    best = malloc(images * sizeof(*best));
+    seen = calloc(entry_count + 1, sizeof(*seen));
+    if (scores == NULL || best == NULL || seen == NULL) {
+        free(font);
+        free(scores);
+        free(best);
+        free(seen);
+        return -1;
+    }
+
+    glyphs = font_glyphs(len);
+    for (i = 0; i < glyphs; i++) {
+        glyph = font_glyph(font, i);
+        if (glyph == 0)
+            continue;
+        queries++;
+
+        // chunks by chain length, shortest first
+        for (c = 0; c < CHUNKS; c++) {
+            key[c] = (unsigned)(glyph >> (c * CHUNK_BITS)) & CHUNK_MASK;
+            for (k = c; k > 0 && lengths[order[k - 1]][key[order[k - 1]]] > lengths[c][key[c]]; k--)
+                order[k] = order[k - 1];
+            order[k] = c;
+        }
+
+        // smallest distance per image for this glyph, -1 when none
+        memset(best, 0xff, images * sizeof(*best));
+        for (k = 0; k <= max_dist; k++) {
+            c = order[k];
+            for (e = heads[c][key[c]]; e >= 0; e = next[c][e]) {
+                if (seen[e] == queries)
+                    continue;
+                seen[e] = queries;
+                d = glyph_popcount(glyph ^ entries[e].glyph);
+                if (d <= max_dist &&
+                    (best[entries[e].image] < 0 || d < best[entries[e].image]))
+                    best[entries[e].image] = d;
+            }
+        }
+
+        for (c = 0; c < images; c++) {
+            if (best[c] >= 0) {
+                scores[c].glyphs++;
+                scores[c].bits += best[c];
+            }
+        }
+    }
+
+    for (c = 0; c < images; c++)
+        scores[c].image = c;
+    qsort(scores, images, sizeof(*scores), compare_scores);
+
+    printf("%s: %zu non-blank glyphs\n", name, queries);
+    for (c = 0; c < count && c < images && scores[c].glyphs; c++)
+        printf("  %5.1f%%  %4zu glyphs  %5zu bits  %-6s  %s\n",
+               queries ? 100.0 * scores[c].glyphs / queries : 0.0,
+               scores[c].glyphs, scores[c].bits,
+               wiring_name[scores[c].image & 1], names[scores[c].image / 2]);
+    if (c == 0)
+        printf("  no match\n");
+
+    free(font);
+    free(scores);
+    free(best);
+    free(seen);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    const char *unknown;
+    int         c, max_dist = 2, count = 5, status = 0;
+
+    while ((c = getopt(argc, argv, "d:n:l:")) != -1) {
+        switch (c) {
+            case 'd': max_dist = atoi(optarg); break;
+            case 'n': count = atoi(optarg); break;
+            case 'l': if (read_list(optarg) < 0) return 2; break;
+            default:  status = 2; break;
+        }
+    }
+
+    if (status || optind >= argc || max_dist < 0 || max_dist >= CHUNKS) {
+        fprintf(stderr, "usage: fontmatch [-d 0..3] [-n count] [-l list] unknown known ...\n");
+        return 2;
+    }
+
+    unknown = argv[optind++];
+    for (; optind < argc; optind++)
+        if (add_name(argv[optind]) < 0)
+            return 2;
+
+    if (name_count == 0) {
+        fprintf(stderr, "fontmatch: no known images\n");
+        return 2;
+    }
+
+    if (build_index() < 0 || match(unknown, max_dist, count) < 0) {
+        fprintf(stderr, "fontmatch: out of memory or read error\n");
+        return 2;
+    }
+
+    return 0;
+}
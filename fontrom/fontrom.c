@@ -0,0 +1,582 @@
+/*
+ * fontrom.c
+ *
+ *  One driver for the font rom tools. The image is loaded once and passed
+ *  through a pipeline of stages in memory, so
+ *
+ *      fontrom convert render < in > out
+ *
+ *  does the work of "reversebits < in | showfont > out" in one process.
+ *
+ *  usage: fontrom [-g] [-i file] stage ...
+ *
+ *  -g  the input image is in GTAC order (default Apple standard order)
+ *  -i  read the image from file instead of stdin
+ *
+ *  Stages, applied in order:
+ *
+ *  convert     standard to GTAC order (reversebits)
+ *  unfix       GTAC to standard order
+ *  render      print glyphs as ascii images (showfont)
+ *  atlas       print glyphs as ascii images, 16 per row
+ *  export      write the atlas as a PBM bitmap
+ *  diff:file   compare with the image in file (see fontdiff)
+ *  detect      guess the bit order of the image; later stages use the
+ *              detected order if it is standard or GTAC
+ *
+ *  Font variants, in whichever bit order the image is in:
+ *
+ *  bold            OR each row with itself moved one pixel right
+ *  underline[:row] set every pixel of a row (default 7, the bottom row)
+ *  shift[:n]       move glyphs down n rows (default 1), up if n < 0
+ *  invert          invert all pixels
+ *  mask:cols       keep only the columns in cols, 0x40 is the leftmost
+ *
+ *  Stage names and arguments are checked before the image is loaded, so a
+ *  bad pipeline fails before any stage has printed.
+ *
+ *  If the last stage is one that changes the image, the resulting image
+ *  is written to stdout. The diff and detect reports then go to stderr,
+ *  and render, atlas and export are refused. Stages that print use the
+ *  bit order the image is in at that point in the pipeline.
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include "fontrom.h"
+
+typedef struct
+{
+    unsigned char *font;
+    size_t         len;
+    size_t         glyphs;
+    bit_order_t    order;
+    const char    *name;
+    FILE          *report;      // detect and diff reports
+} image_t;
+
+// what a stage prints
+enum
+{
+    OUTPUT_NONE,                // changes the image
+    OUTPUT_REPORT,              // a text report, moved to stderr if the image is written
+    OUTPUT_DATA,                // glyphs or a bitmap on stdout
+};
+
+typedef struct
+{
+    const char *name;
+    int         output;
+    int         (*run)(image_t *, const char *arg);
+    const char *(*check)(const char *arg);     // NULL if arg is valid, else the problem
+} stage_t;
+
+static int stage_convert(image_t *img, const char *arg)
+{
+    (void)arg;
+
+    if (img->order == ORDER_GTAC)
+        fprintf(stderr, "fontrom: convert: image is already in GTAC order\n");
+    perm_buf(img->font, img->len, PERM_FIX, PERM_SWAR);
+    img->order = ORDER_GTAC;
+
+    return 0;
+}
+
+static int stage_unfix(image_t *img, const char *arg)
+{
+    (void)arg;
+
+    if (img->order == ORDER_STANDARD)
+        fprintf(stderr, "fontrom: unfix: image is already in standard order\n");
+    perm_buf(img->font, img->len, PERM_UNFIX, PERM_SWAR);
+    img->order = ORDER_STANDARD;
+
+    return 0;
+}
+
+static int stage_render(image_t *img, const char *arg)
+{
+    (void)arg;
+
+    font_render(stdout, img->font, img->len, img->order);
+    return 0;
+}
+
+static int stage_atlas(image_t *img, const char *arg)
+{
+    (void)arg;
+
+    font_atlas(stdout, img->font, img->glyphs, img->order);
+    return 0;
+}
+
+/*
+ * stage_export()
+ *
+ *  Write the atlas as a binary PBM (P4) image, 7x8 pixels per glyph and
+ *  16 glyphs per row. Set pixels are black.
+ */
+static int stage_export(image_t *img, const char *arg)
+{
+    size_t         rows = (img->glyphs + ATLAS_COLUMNS - 1) / ATLAS_COLUMNS;
+    int            width = ATLAS_COLUMNS * GLYPH_COLS;
+    unsigned char  line[(ATLAS_COLUMNS * GLYPH_COLS + 7) / 8];
+    unsigned char  byte;
+    size_t         r, g;
+    int            y, x, px;
+
+    (void)arg;
+
+    printf("P4\n%d %zu\n", width, rows * GLYPH_ROWS);
+
+    for (r = 0; r < rows; r++) {
+        for (y = 0; y < GLYPH_ROWS; y++) {
+            memset(line, 0, sizeof(line));
+            for (x = 0; x < ATLAS_COLUMNS; x++) {
+                g = r * ATLAS_COLUMNS + x;
+                if (g >= img->glyphs)
+                    break;
+                byte = img->font[g * GLYPH_ROWS + y];
+                for (px = 0; px < GLYPH_COLS; px++)
+                    if (byte & order_cols[img->order][px])
+                        line[(x * GLYPH_COLS + px) / 8] |= 0x80 >> ((x * GLYPH_COLS + px) % 8);
+            }
+            fwrite(line, 1, sizeof(line), stdout);
+        }
+    }
+
+    return 0;
+}
+
+static int stage_diff(image_t *img, const char *arg)
+{
+    unsigned char *ref;
+    size_t         len;
+
+    if ((ref = font_load(arg, &len)) == NULL)
+        return -1;
+
+    font_diff(img->report, arg, ref, len, img->name, img->font, img->len, img->order, 0);
+    free(ref);
+
+    return 0;
+}
+
+/*
+ * Font variants
+ *
+ *  Each variant is an operation on a whole glyph word in standard order,
+ *  where bits 0x7f of every byte are the pixels with the leftmost in
+ *  0x40. GTAC images are taken to standard order and back one word at a
+ *  time. The flash/inverse bit of every row is kept as it is.
+ */
+#define PIXELS          BYTES(0x7f)
+#define FLAGS           BYTES(0x80)
+
+// OR every row with itself moved one pixel right
+static glyph_t variant_bold(glyph_t g, long arg)
+{
+    (void)arg;
+    return g | ((g & BYTES(0x7e)) >> 1);
+}
+
+// Set all pixels of one row, the bottom row by default
+static glyph_t variant_underline(glyph_t g, long arg)
+{
+    return g | ((glyph_t)0x7f << (8 * arg));
+}
+
+// Move the glyph down (arg > 0) or up (arg < 0) by arg rows
+static glyph_t variant_shift(glyph_t g, long arg)
+{
+    glyph_t pixels = g & PIXELS;
+
+    if (arg >= GLYPH_ROWS || arg <= -GLYPH_ROWS)
+        pixels = 0;
+    else if (arg > 0)
+        pixels <<= 8 * arg;
+    else
+        pixels >>= 8 * -arg;
+
+    return (g & FLAGS) | pixels;
+}
+
+static glyph_t variant_invert(glyph_t g, long arg)
+{
+    (void)arg;
+    return g ^ PIXELS;
+}
+
+// Keep only the columns set in arg, 0x40 being the leftmost column
+static glyph_t variant_mask(glyph_t g, long arg)
+{
+    return g & (FLAGS | BYTES(arg & 0x7f));
+}
+
+static int apply_variant(image_t *img, glyph_t (*op)(glyph_t, long), long arg)
+{
+    size_t  i;
+    glyph_t g;
+
+    for (i = 0; i < img->glyphs; i++) {
+        g = font_glyph(img->font, i);
+        if (img->order == ORDER_GTAC)
+            g = fix_bits_word(op(unfix_bits_word(g), arg));
+        else
+            g = op(g, arg);
+        font_put_glyph(img->font, i, g);
+    }
+
+    return 0;
+}
+
+static int stage_bold(image_t *img, const char *arg)
+{
+    (void)arg;
+    return apply_variant(img, variant_bold, 0);
+}
+
+static int stage_underline(image_t *img, const char *arg)
+{
+    return apply_variant(img, variant_underline, arg ? strtol(arg, NULL, 0) : GLYPH_ROWS - 1);
+}
+
+static int stage_shift(image_t *img, const char *arg)
+{
+    return apply_variant(img, variant_shift, arg ? strtol(arg, NULL, 0) : 1);
+}
+
+static int stage_invert(image_t *img, const char *arg)
+{
+    (void)arg;
+    return apply_variant(img, variant_invert, 0);
+}
+
+static int stage_mask(image_t *img, const char *arg)
+{
+    return apply_variant(img, variant_mask, strtol(arg, NULL, 0));
+}
+
+/*
+ * Bit order detection
+ *
+ *  Each candidate wiring is undone with a byte table, then the result is
+ *  scored on statistics that hold for Apple II fonts in standard order:
+ *
+ *  sym    fraction of non-blank glyphs that are left/right symmetric
+ *  flag   fraction of glyphs whose flash/inverse bit is the same on all rows
+ *  edge   fraction of set pixels in the outer two columns, which are blank
+ *         in 5 pixel wide characters
+ *  stem   glyphs with a vertical stroke of STEM_ROWS or more down their
+ *         leftmost column only, against those with one down the rightmost
+ *         only; B D E F K L P R b h k p have a stem on the left, J d q on
+ *         the right, which tells a font from its mirror image
+ *
+ *  The best wiring must score DETECT_MIN_SCORE and beat the next one by
+ *  DETECT_MIN_MARGIN, else the order is reported as unknown.
+ */
+#define DETECT_MIN_SCORE    1.0
+#define DETECT_MIN_MARGIN   0.25
+#define STEM_ROWS           5
+
+typedef struct
+{
+    const char   *name;
+    int           order;        // bit_order_t when this candidate wins, or -1
+    unsigned char table[256];   // image byte to standard order
+} wiring_t;
+
+static wiring_t wirings[] =
+{
+    { "standard", ORDER_STANDARD, { 0 } },
+    { "gtac",     ORDER_GTAC,     { 0 } },
+    { "reversed", -1,             { 0 } },     // pixels mirrored, bit 0 leftmost
+};
+
+static int wirings_ready;
+
+#define WIRINGS     (sizeof(wirings) / sizeof(wirings[0]))
+
+static unsigned char mirror_byte(unsigned char b)
+{
+    unsigned char m = b & 0x80;
+    int           i;
+
+    for (i = 0; i < GLYPH_COLS; i++)
+        if (b & (1 << i))
+            m |= 0x40 >> i;
+
+    return m;
+}
+
+static uint64_t mirror_word(uint64_t x)
+{
+    return ((x & BYTES(0x40)) >> 6) | ((x & BYTES(0x01)) << 6) |
+           ((x & BYTES(0x20)) >> 4) | ((x & BYTES(0x02)) << 4) |
+           ((x & BYTES(0x10)) >> 2) | ((x & BYTES(0x04)) << 2) |
+            (x & BYTES(0x88));
+}
+
+// longest run of rows with pixel bit set
+static int column_run(const unsigned char *bytes, int bit)
+{
+    int y, run = 0, longest = 0;
+
+    for (y = 0; y < GLYPH_ROWS; y++) {
+        run = bytes[y] & bit ? run + 1 : 0;
+        if (run > longest)
+            longest = run;
+    }
+
+    return longest;
+}
+
+// +1 for a stem on the left only, -1 on the right only, else 0
+static int glyph_stem(const unsigned char *bytes)
+{
+    int used = 0, y, left, right;
+
+    for (y = 0; y < GLYPH_ROWS; y++)
+        used |= bytes[y] & 0x7f;
+    if (used == 0 || (used & (used - 1)) == 0)
+        return 0;
+
+    for (left = 0x40; !(used & left); left >>= 1)
+        ;
+    right = used & -used;
+
+    left = column_run(bytes, left) >= STEM_ROWS;
+    right = column_run(bytes, right) >= STEM_ROWS;
+
+    return left - right;
+}
+
+static double score_wiring(const wiring_t *w, const unsigned char *font, size_t glyphs,
+                           double *sym, double *flag, double *edge, double *stem)
+{
+    unsigned char bytes[GLYPH_ROWS];
+    size_t        cols[8] = { 0 };
+    size_t        i, symmetric = 0, uniform = 0, used = 0, pixels;
+    long          stems = 0, stemmed = 0;
+    glyph_t       g, flags;
+    int           b;
+
+    for (i = 0; i < glyphs; i++) {
+        for (b = 0; b < GLYPH_ROWS; b++)
+            bytes[b] = w->table[font[i * GLYPH_ROWS + b]];
+        memcpy(&g, bytes, sizeof(g));
+
+        b = glyph_stem(bytes);
+        stems += b;
+        stemmed += b != 0;
+
+        for (b = 0; b < 8; b++)
+            cols[b] += glyph_popcount(g & BYTES(1 << b));
+
+        flags = g & BYTES(0x80);
+        if (flags == 0 || flags == BYTES(0x80))
+            uniform++;
+
+        g &= BYTES(0x7f);
+        if (g != 0) {
+            used++;
+            if (mirror_word(g) == g)
+                symmetric++;
+        }
+    }
+
+    pixels = cols[0] + cols[1] + cols[2] + cols[3] + cols[4] + cols[5] + cols[6];
+
+    *sym = used ? (double)symmetric / used : 0.0;
+    *flag = glyphs ? (double)uniform / glyphs : 0.0;
+    *edge = pixels ? (double)(cols[6] + cols[0]) / pixels : 0.0;
+    *stem = stemmed ? (double)stems / stemmed : 0.0;
+
+    return *sym + *flag - *edge + *stem / 2;
+}
+
+static int stage_detect(image_t *img, const char *arg)
+{
+    double score, best_score = -1.0, next_score = -1.0, sym, flag, edge, stem;
+    size_t i, best = 0;
+    int    b;
+
+    (void)arg;
+
+    if (!wirings_ready) {
+        for (b = 0; b < 256; b++) {
+            wirings[0].table[b] = (unsigned char)b;
+            wirings[1].table[b] = perm_table[PERM_UNFIX][b];
+            wirings[2].table[b] = mirror_byte((unsigned char)b);
+        }
+        wirings_ready = 1;
+    }
+
+    for (i = 0; i < WIRINGS; i++) {
+        score = score_wiring(&wirings[i], img->font, img->glyphs, &sym, &flag, &edge, &stem);
+        fprintf(img->report, "%-8s  score %5.2f  sym %4.2f  flag %4.2f  edge %4.2f  stem %5.2f\n",
+                wirings[i].name, score, sym, flag, edge, stem);
+        if (score > best_score) {
+            next_score = best_score;
+            best_score = score;
+            best = i;
+        }
+        else if (score > next_score)
+            next_score = score;
+    }
+
+    if (best_score < DETECT_MIN_SCORE || best_score - next_score < DETECT_MIN_MARGIN) {
+        fprintf(img->report, "%s: unknown bit order\n", img->name);
+        return 0;
+    }
+
+    fprintf(img->report, "%s: %s\n", img->name, wirings[best].name);
+    if (wirings[best].order >= 0)
+        img->order = (bit_order_t)wirings[best].order;
+
+    return 0;
+}
+
+/*
+ * Stage argument checks
+ */
+static int parse_long(const char *arg, long *value)
+{
+    char *end;
+
+    *value = strtol(arg, &end, 0);
+    return end != arg && *end == '\0';
+}
+
+static const char *check_none(const char *arg)
+{
+    return arg ? "takes no argument" : NULL;
+}
+
+static const char *check_file(const char *arg)
+{
+    return arg == NULL || *arg == '\0' ? "needs a file, diff:file" : NULL;
+}
+
+static const char *check_row(const char *arg)
+{
+    long row;
+
+    if (arg == NULL)
+        return NULL;
+    return parse_long(arg, &row) && row >= 0 && row < GLYPH_ROWS ? NULL : "row must be 0..7";
+}
+
+static const char *check_shift(const char *arg)
+{
+    long n;
+
+    return arg == NULL || parse_long(arg, &n) ? NULL : "needs a number of rows, shift:n";
+}
+
+static const char *check_mask(const char *arg)
+{
+    long cols;
+
+    return arg && parse_long(arg, &cols) && cols >= 0 && cols <= 0x7f ?
+           NULL : "needs a column mask 0..0x7f, mask:0x3e";
+}
+
+static const stage_t stages[] =
+{
+    { "convert",   OUTPUT_NONE,   stage_convert,   check_none },
+    { "unfix",     OUTPUT_NONE,   stage_unfix,     check_none },
+    { "render",    OUTPUT_DATA,   stage_render,    check_none },
+    { "atlas",     OUTPUT_DATA,   stage_atlas,     check_none },
+    { "export",    OUTPUT_DATA,   stage_export,    check_none },
+    { "diff",      OUTPUT_REPORT, stage_diff,      check_file },
+    { "detect",    OUTPUT_REPORT, stage_detect,    check_none },
+    { "bold",      OUTPUT_NONE,   stage_bold,      check_none },
+    { "underline", OUTPUT_NONE,   stage_underline, check_row },
+    { "shift",     OUTPUT_NONE,   stage_shift,     check_shift },
+    { "invert",    OUTPUT_NONE,   stage_invert,    check_none },
+    { "mask",      OUTPUT_NONE,   stage_mask,      check_mask },
+};
+
+static const stage_t *find_stage(const char *word, const char **arg)
+{
+    size_t i, n = strcspn(word, ":");
+
+    *arg = word[n] == ':' ? word + n + 1 : NULL;
+
+    for (i = 0; i < sizeof(stages) / sizeof(stages[0]); i++)
+        if (strlen(stages[i].name) == n && strncmp(stages[i].name, word, n) == 0)
+            return &stages[i];
+
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    image_t        img = { NULL, 0, 0, ORDER_STANDARD, "-", NULL };
+    const stage_t *stage = NULL;
+    const char    *arg, *problem, *data = NULL;
+    int            c, i, status = 0;
+
+    perm_init();
+
+    while ((c = getopt(argc, argv, "gi:")) != -1) {
+        switch (c) {
+            case 'g': img.order = ORDER_GTAC; break;
+            case 'i': img.name = optarg; break;
+            default:  status = 2; break;
+        }
+    }
+
+    if (status || optind == argc) {
+        fprintf(stderr, "usage: fontrom [-g] [-i file] stage ...\n"
+                        "stages: convert unfix render atlas export diff:file detect\n"
+                        "        bold underline[:row] shift[:n] invert mask:cols\n");
+        return 2;
+    }
+
+    // check the whole pipeline before doing any work
+    for (i = optind; i < argc; i++) {
+        if ((stage = find_stage(argv[i], &arg)) == NULL) {
+            fprintf(stderr, "fontrom: unknown stage %s\n", argv[i]);
+            return 2;
+        }
+        if ((problem = stage->check(arg)) != NULL) {
+            fprintf(stderr, "fontrom: %s: %s\n", stage->name, problem);
+            return 2;
+        }
+        if (stage->output == OUTPUT_DATA)
+            data = stage->name;
+    }
+
+    // the image goes to stdout, so nothing else may
+    img.report = stdout;
+    if (stage->output == OUTPUT_NONE) {
+        if (data != NULL) {
+            fprintf(stderr, "fontrom: %s: output would be mixed with the image, "
+                            "end the pipeline with a printing stage\n", data);
+            return 2;
+        }
+        img.report = stderr;
+    }
+
+    if ((img.font = font_load(img.name, &img.len)) == NULL)
+        return 1;
+    img.glyphs = font_glyphs(img.len);
+
+    for (i = optind; i < argc; i++) {
+        stage = find_stage(argv[i], &arg);
+        if (stage->run(&img, arg) < 0) {
+            free(img.font);
+            return 1;
+        }
+    }
+
+    if (stage->output == OUTPUT_NONE)
+        fwrite(img.font, 1, img.len, stdout);
+
+    free(img.font);
+    return 0;
+}
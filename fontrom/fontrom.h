@@ -0,0 +1,403 @@
+/*
+ * fontrom.h
+ *
+ *  Helpers shared by the font ROM tools. Everything here is static so each
+ *  tool still builds from a single source file, e.g.
+ *
+ *      cc -O2 -o fontdiff fontdiff.c
+ *
+ *  A font image is a sequence of glyphs, 8 bytes (one per scan line) each.
+ *  A glyph is also handled as one 64-bit word so whole glyphs can be
+ *  compared and counted with plain integer operations.
+ *
+ *  Two bit orders are in use:
+ *
+ *  standard  Apple II order (e.g. the Dan Paymar image). Pixels left to
+ *            right are bits 0x40 0x20 0x10 0x08 0x04 0x02 0x01, bit 0x80
+ *            is the flash/inverse bit.
+ *  GTAC      order expected by the GTAC-2 video hardware, produced by
+ *            fixBits(). Pixels left to right are bits 0x02 0x08 0x10 0x20
+ *            0x40 0x80 0x04, bit 0x01 goes to the flash/inverse hardware.
+ */
+
+#ifndef FONTROM_H
+#define FONTROM_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define GLYPH_ROWS      8
+#define GLYPH_COLS      7
+
+typedef uint64_t glyph_t;
+
+typedef enum
+{
+    ORDER_STANDARD,
+    ORDER_GTAC
+} bit_order_t;
+
+// Pixel masks left to right for each bit order
+static const unsigned char order_cols[2][GLYPH_COLS] =
+{
+    { 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01 },
+    { 0x02, 0x08, 0x10, 0x20, 0x40, 0x80, 0x04 }
+};
+
+// Flash/inverse bit for each bit order
+static const unsigned char order_flag[2] = { 0x80, 0x01 };
+
+// Function to fix bits of num to match hardware on gtac-2 clone
+static inline unsigned int fixBits(unsigned char num)
+{
+    unsigned char fixed = 0;
+
+    /* test each bit of original and set appropriate in fixed */
+    if(num & 0x01) fixed |= 0x04;
+    if(num & 0x02) fixed |= 0x80;
+    if(num & 0x04) fixed |= 0x40;
+    if(num & 0x08) fixed |= 0x20;
+    if(num & 0x10) fixed |= 0x10;
+    if(num & 0x20) fixed |= 0x08;
+    if(num & 0x40) fixed |= 0x02;
+    if(num & 0x80) fixed |= 0x01;
+
+    return fixed;
+}
+
+// Inverse of fixBits(), GTAC order back to standard order
+static inline unsigned int unfixBits(unsigned char num)
+{
+    unsigned char fixed = 0;
+
+    if(num & 0x04) fixed |= 0x01;
+    if(num & 0x80) fixed |= 0x02;
+    if(num & 0x40) fixed |= 0x04;
+    if(num & 0x20) fixed |= 0x08;
+    if(num & 0x10) fixed |= 0x10;
+    if(num & 0x08) fixed |= 0x20;
+    if(num & 0x02) fixed |= 0x40;
+    if(num & 0x01) fixed |= 0x80;
+
+    return fixed;
+}
+
+/*
+ * Fast permutation engine
+ *
+ *  PERM_SCALAR calls fixBits()/unfixBits() per byte and is the reference.
+ *  PERM_TABLE looks each byte up in a 256 entry table. PERM_SWAR permutes
+ *  8 bytes at once in a 64-bit word: the bits that move by the same
+ *  distance are masked and shifted together, and no bit crosses a byte
+ *  boundary. The compiler further vectorizes the word loop where the
+ *  target allows.
+ */
+typedef enum
+{
+    PERM_FIX,                   // standard to GTAC
+    PERM_UNFIX                  // GTAC to standard
+} perm_dir_t;
+
+typedef enum
+{
+    PERM_SCALAR,
+    PERM_TABLE,
+    PERM_SWAR
+} perm_backend_t;
+
+static unsigned char perm_table[2][256];
+
+static inline void perm_init(void)
+{
+    int i;
+
+    for (i = 0; i < 256; i++) {
+        perm_table[PERM_FIX][i] = (unsigned char)fixBits((unsigned char)i);
+        perm_table[PERM_UNFIX][i] = (unsigned char)unfixBits((unsigned char)i);
+    }
+}
+
+#define BYTES(b)        (0x0101010101010101ULL * (b))
+
+static inline uint64_t fix_bits_word(uint64_t x)
+{
+    return ((x & BYTES(0x09)) << 2) |
+           ((x & BYTES(0x02)) << 6) |
+           ((x & BYTES(0x04)) << 4) |
+            (x & BYTES(0x10))       |
+           ((x & BYTES(0x20)) >> 2) |
+           ((x & BYTES(0x40)) >> 5) |
+           ((x & BYTES(0x80)) >> 7);
+}
+
+static inline uint64_t unfix_bits_word(uint64_t x)
+{
+    return ((x & BYTES(0x24)) >> 2) |
+           ((x & BYTES(0x80)) >> 6) |
+           ((x & BYTES(0x40)) >> 4) |
+            (x & BYTES(0x10))       |
+           ((x & BYTES(0x08)) << 2) |
+           ((x & BYTES(0x02)) << 5) |
+           ((x & BYTES(0x01)) << 7);
+}
+
+/*
+ * perm_buf()
+ *
+ *  Permute every byte of a buffer in place. perm_init() must have been
+ *  called for PERM_TABLE and PERM_SWAR.
+ */
+static inline void perm_buf(unsigned char *buf, size_t len, perm_dir_t dir,
+                            perm_backend_t backend)
+{
+    const unsigned char *table = perm_table[dir];
+    size_t               i = 0;
+    uint64_t             w;
+
+    switch (backend) {
+        case PERM_SWAR:
+            for (; i + sizeof(w) <= len; i += sizeof(w)) {
+                memcpy(&w, buf + i, sizeof(w));
+                w = dir == PERM_FIX ? fix_bits_word(w) : unfix_bits_word(w);
+                memcpy(buf + i, &w, sizeof(w));
+            }
+            /* fall through for the tail */
+        case PERM_TABLE:
+            for (; i < len; i++)
+                buf[i] = table[buf[i]];
+            break;
+        case PERM_SCALAR:
+            for (; i < len; i++)
+                buf[i] = (unsigned char)(dir == PERM_FIX ? fixBits(buf[i])
+                                                         : unfixBits(buf[i]));
+            break;
+    }
+}
+
+/*
+ * font_read()
+ *
+ *  Read a whole font image from a stream. The buffer is padded with zero
+ *  bytes up to a whole number of glyphs; *len is the unpadded length.
+ *  Returns NULL on allocation or read error.
+ */
+static inline unsigned char *font_read(FILE *in, size_t *len)
+{
+    size_t         size = 4096, n = 0;
+    unsigned char *buf = malloc(size), *tmp;
+
+    // the last GLYPH_ROWS bytes of the buffer are kept for padding
+    while (buf != NULL) {
+        n += fread(buf + n, 1, size - GLYPH_ROWS - n, in);
+        if (n < size - GLYPH_ROWS) {
+            if (ferror(in))
+                break;
+            memset(buf + n, 0, GLYPH_ROWS);
+            *len = n;
+            return buf;
+        }
+        tmp = realloc(buf, size * 2);
+        if (tmp == NULL)
+            break;
+        buf = tmp;
+        size *= 2;
+    }
+
+    free(buf);
+    return NULL;
+}
+
+/*
+ * font_load()
+ *
+ *  font_read() by file name, "-" is stdin. Prints a message on error.
+ */
+static inline unsigned char *font_load(const char *name, size_t *len)
+{
+    FILE          *in = stdin;
+    unsigned char *buf;
+
+    if (strcmp(name, "-") != 0 && (in = fopen(name, "rb")) == NULL) {
+        perror(name);
+        return NULL;
+    }
+
+    buf = font_read(in, len);
+    if (buf == NULL)
+        fprintf(stderr, "%s: read error\n", name);
+    if (in != stdin)
+        fclose(in);
+
+    return buf;
+}
+
+static inline size_t font_glyphs(size_t len)
+{
+    return (len + GLYPH_ROWS - 1) / GLYPH_ROWS;
+}
+
+// Scan line y of a glyph is byte y of the word, counting from the low end
+static inline glyph_t font_glyph(const unsigned char *font, size_t index)
+{
+    glyph_t glyph;
+
+    memcpy(&glyph, font + index * GLYPH_ROWS, sizeof(glyph));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    glyph = __builtin_bswap64(glyph);
+#endif
+    return glyph;
+}
+
+static inline void font_put_glyph(unsigned char *font, size_t index, glyph_t glyph)
+{
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    glyph = __builtin_bswap64(glyph);
+#endif
+    memcpy(font + index * GLYPH_ROWS, &glyph, sizeof(glyph));
+}
+
+static inline int glyph_popcount(glyph_t glyph)
+{
+    return __builtin_popcountll(glyph);
+}
+
+/*
+ * render_row()
+ *
+ *  Render one scan line as 7 characters plus a terminating zero.
+ */
+static inline void render_row(unsigned char row, bit_order_t order, char *out)
+{
+    int x;
+
+    for (x = 0; x < GLYPH_COLS; x++)
+        out[x] = (row & order_cols[order][x]) ? '#' : ' ';
+    out[GLYPH_COLS] = 0;
+}
+
+/*
+ * Glyph cache: every possible scan line rendered once per bit order, so
+ * font_render() and font_atlas() only copy strings.
+ */
+static char row_cache[2][256][GLYPH_COLS + 1];
+static int  row_cache_valid[2];
+
+static inline const char *cached_row(bit_order_t order, unsigned char row)
+{
+    int i;
+
+    if (!row_cache_valid[order]) {
+        for (i = 0; i < 256; i++)
+            render_row((unsigned char)i, order, row_cache[order][i]);
+        row_cache_valid[order] = 1;
+    }
+
+    return row_cache[order][row];
+}
+
+/*
+ * font_render()
+ *
+ *  Print glyphs as ascii images in the showfont layout: one line per scan
+ *  line and two blank lines after each glyph.
+ */
+static inline void font_render(FILE *out, const unsigned char *font, size_t len,
+                               bit_order_t order)
+{
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        fputs(cached_row(order, font[i]), out);
+        putc('\n', out);
+        if (i % GLYPH_ROWS == GLYPH_ROWS - 1)
+            fputs("\n\n", out);
+    }
+}
+
+#define ATLAS_COLUMNS   16
+
+/*
+ * font_atlas()
+ *
+ *  Print glyphs as ascii images, 16 side by side under their first code.
+ */
+static inline void font_atlas(FILE *out, const unsigned char *font, size_t glyphs,
+                              bit_order_t order)
+{
+    size_t first, g;
+    int    y;
+
+    for (first = 0; first < glyphs; first += ATLAS_COLUMNS) {
+        fprintf(out, "$%02zx\n", first);
+        for (y = 0; y < GLYPH_ROWS; y++) {
+            for (g = first; g < first + ATLAS_COLUMNS && g < glyphs; g++) {
+                putc('|', out);
+                fputs(cached_row(order, font[g * GLYPH_ROWS + y]), out);
+            }
+            fputs("|\n", out);
+        }
+    }
+}
+
+/*
+ * font_diff()
+ *
+ *  Compare two images glyph by glyph. Unless quiet, every changed glyph is
+ *  printed to out with the reference, test and changed pixels side by side.
+ *  Returns the number of differing glyphs, a length mismatch counts as one.
+ */
+static inline size_t font_diff(FILE *out,
+                               const char *ref_name, const unsigned char *ref, size_t ref_len,
+                               const char *test_name, const unsigned char *test, size_t test_len,
+                               bit_order_t order, int quiet)
+{
+    char                 a[GLYPH_COLS + 1], b[GLYPH_COLS + 1], d[GLYPH_COLS + 1];
+    const unsigned char *r, *t;
+    size_t               glyphs, i, changed = 0, pixels = 0;
+    glyph_t              x;
+    int                  n, y;
+
+    glyphs = font_glyphs(ref_len < test_len ? ref_len : test_len);
+
+    for (i = 0; i < glyphs; i++) {
+        x = font_glyph(ref, i) ^ font_glyph(test, i);
+        if (x == 0)
+            continue;
+
+        n = glyph_popcount(x);
+        changed++;
+        pixels += n;
+
+        if (quiet)
+            continue;
+
+        fprintf(out, "glyph $%02zx (offset 0x%04zx): %d bit%s differ\n",
+                i, i * GLYPH_ROWS, n, n == 1 ? "" : "s");
+
+        r = ref + i * GLYPH_ROWS;
+        t = test + i * GLYPH_ROWS;
+        for (y = 0; y < GLYPH_ROWS; y++) {
+            render_row(r[y], order, a);
+            render_row(t[y], order, b);
+            render_row(r[y] ^ t[y], order, d);
+            fprintf(out, "  |%s|  |%s|  |%s|%s\n", a, b, d,
+                    ((r[y] ^ t[y]) & order_flag[order]) ? " flash/inverse bit" : "");
+        }
+    }
+
+    if (ref_len != test_len) {
+        fprintf(out, "%s: %zu bytes, %s: %zu bytes\n",
+                ref_name, ref_len, test_name, test_len);
+        changed++;
+    }
+
+    if (changed || !quiet)
+        fprintf(out, "%s %s: %zu glyph%s differ, %zu bits\n", ref_name, test_name,
+                changed, changed == 1 ? "" : "s", pixels);
+
+    return changed;
+}
+
+#endif
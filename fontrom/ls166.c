@@ -0,0 +1,281 @@
+/*
+ * ls166.c
+ *
+ *  Clock level model of the text video path from the font ROM through the
+ *  LS166 shift register, used as a reference for the renderers and for
+ *  new wiring maps.
+ *
+ *  usage: ls166 [-s] [-w wiring] [-n frames] [-p] image
+ *
+ *  -s  standard Apple II wiring and bit order instead of GTAC
+ *  -w  model this wiring instead, as the ROM outputs on LS166 inputs
+ *      H,G,F,E,D,C,B, e.g. the GTAC wiring is "2,4,5,6,7,8,3"; it is
+ *      checked against the GTAC (or with -s standard) bit order; each
+ *      output may be used once
+ *  -n  frames to run (default 1000); each frame moves the test screen on
+ *      by 960 codes so every glyph is seen on every scan line
+ *  -p  print the pixel stream of the first frame, one line per scan line
+ *
+ *  Each character time is 7 rising edges of 7M. On the edge where ^LDPS
+ *  (derived from Q3 and the character phase) is low the LS166 loads A..H
+ *  in parallel; on the other six it shifts towards QH, which is the
+ *  serial pixel output. So H leaves first and A, the flash/inverse input,
+ *  is never shifted out before the next load.
+ *
+ *  The register is bit-sliced by scan line: each stage holds one bit for
+ *  each of the 192 lines of the text page in three 64-bit words, so each
+ *  shift moves all lines at once and one pass over the 280 dot clocks of
+ *  a line produces the whole frame. The parallel load still looks up the
+ *  ROM byte of every line one at a time.
+ *
+ *  Without -w the register inputs are wired from the pin table below,
+ *  transcribed from gtac_fontrom_info.txt (the standard one from the
+ *  Apple II image layout), not from the bit order tables in fontrom.h. The output is checked pixel by
+ *  pixel against cached_row(), so a run tests both the shift direction
+ *  and that the documented wiring gives the renderers' bit order. After
+ *  the image frames one more frame is run on a column test font, where
+ *  glyph k has only ROM output k+1 set on every row, so each output lights
+ *  one column by itself and a swap of any two pins shows up even if no
+ *  glyph of the image uses the columns involved.
+ *
+ *  build: cc -O2 -o ls166 ls166.c
+ */
+
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "fontrom.h"
+
+#define TEXT_COLS       40
+#define TEXT_ROWS       24
+#define SCAN_LINES      (TEXT_ROWS * GLYPH_ROWS)
+#define DOTS            (TEXT_COLS * GLYPH_COLS)
+#define WORDS           ((SCAN_LINES + 63) / 64)
+
+// LS166 stages, QA..QH
+enum { QA, QB, QC, QD, QE, QF, QG, QH, STAGES };
+
+typedef uint64_t slice_t[WORDS];
+
+// ROM output mask on each LS166 input, A..H
+typedef unsigned char wiring_t[STAGES];
+
+// ROM output (O1..O8) on each LS166 input A..H
+static const unsigned char rom_pins[2][STAGES] =
+{
+    // standard: O8 flash/inverse, O1..O7 on B..H, O7 first out
+    { 8, 1, 2, 3, 4, 5, 6, 7 },
+    // GTAC: pin 9 (O1) flash/inverse, then B=O3 C=O8 D=O7 E=O6 F=O5 G=O4 H=O2
+    { 1, 3, 8, 7, 6, 5, 4, 2 }
+};
+
+static slice_t        stage[STAGES];
+static slice_t        pixels[DOTS];
+static unsigned char  screen[TEXT_ROWS * TEXT_COLS];
+
+/*
+ * set_wiring()
+ *
+ *  Build the input masks from the pixel masks of a bit order: the first
+ *  pixel comes from H, the flag bit goes to A.
+ */
+static void set_wiring(wiring_t wiring, const unsigned char *cols, unsigned char flag)
+{
+    int x;
+
+    for (x = 0; x < GLYPH_COLS; x++)
+        wiring[QH - x] = cols[x];
+    wiring[QA] = flag;
+}
+
+static void pin_wiring(wiring_t wiring, const unsigned char *pins)
+{
+    int s;
+
+    for (s = QA; s < STAGES; s++)
+        wiring[s] = (unsigned char)(1 << (pins[s] - 1));
+}
+
+/*
+ * load()
+ *
+ *  Parallel load of one character column: for each scan line look up its
+ *  character and glyph row and spread the ROM byte over the inputs.
+ */
+static void load(const unsigned char *font, size_t glyphs, const wiring_t wiring, int col)
+{
+    unsigned char byte;
+    uint64_t      bit;
+    int           line, s;
+
+    memset(stage, 0, sizeof(stage));
+    for (line = 0; line < SCAN_LINES; line++) {
+        byte = font[(screen[line / GLYPH_ROWS * TEXT_COLS + col] % glyphs) * GLYPH_ROWS +
+                    line % GLYPH_ROWS];
+        bit = (uint64_t)1 << (line % 64);
+        for (s = QA; s < STAGES; s++)
+            stage[s][line / 64] |= (uint64_t)-((byte & wiring[s]) != 0) & bit;
+    }
+}
+
+/*
+ * frame()
+ *
+ *  Clock the shift register through one visible frame. pixels[dot] holds
+ *  QH for every scan line after that dot's 7M edge.
+ */
+static void frame(const unsigned char *font, size_t glyphs, const wiring_t wiring)
+{
+    int dot, phase, s, w;
+
+    for (dot = 0; dot < DOTS; dot++) {
+        phase = dot % GLYPH_COLS;
+
+        if (phase == 0)
+            load(font, glyphs, wiring, dot / GLYPH_COLS);
+        else {
+            // serial input tied low
+            for (s = QH; s > QA; s--)
+                memcpy(stage[s], stage[s - 1], sizeof(slice_t));
+            memset(stage[QA], 0, sizeof(slice_t));
+        }
+
+        for (w = 0; w < WORDS; w++)
+            pixels[dot][w] = stage[QH][w];
+    }
+}
+
+static int pixel(int line, int dot)
+{
+    return (pixels[dot][line / 64] >> (line % 64)) & 1;
+}
+
+/*
+ * check()
+ *
+ *  Compare the frame with the renderer for a bit order. Returns the
+ *  number of differing pixels.
+ */
+static size_t check(const unsigned char *font, size_t glyphs, bit_order_t order)
+{
+    unsigned char byte;
+    size_t        errors = 0;
+    int           line, dot, expect;
+
+    for (line = 0; line < SCAN_LINES; line++) {
+        for (dot = 0; dot < DOTS; dot++) {
+            byte = font[(screen[line / GLYPH_ROWS * TEXT_COLS + dot / GLYPH_COLS] % glyphs) *
+                        GLYPH_ROWS + line % GLYPH_ROWS];
+            expect = cached_row(order, byte)[dot % GLYPH_COLS] == '#';
+            if (pixel(line, dot) != expect && errors++ < 10)
+                fprintf(stderr, "line %d dot %d: model %d, renderer %d\n",
+                        line, dot, pixel(line, dot), expect);
+        }
+    }
+
+    return errors;
+}
+
+static int parse_wiring(const char *arg, unsigned char *cols)
+{
+    unsigned char used = 0;
+    char         *end;
+    long          out;
+    int           x;
+
+    for (x = 0; x < GLYPH_COLS; x++) {
+        out = strtol(arg, &end, 10);
+        if (end == arg || out < 1 || out > 8 || (x < GLYPH_COLS - 1 && *end != ','))
+            return -1;
+        cols[x] = (unsigned char)(1 << (out - 1));
+        if (used & cols[x]) {
+            fprintf(stderr, "ls166: ROM output %ld wired twice\n", out);
+            return -1;
+        }
+        used |= cols[x];
+        arg = end + 1;
+    }
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned char *font;
+    unsigned char  cols[GLYPH_COLS], flag, column_font[STAGES * GLYPH_ROWS];
+    wiring_t       wiring;
+    size_t         len, glyphs, errors = 0;
+    struct timespec start, end;
+    double         usec;
+    bit_order_t    order = ORDER_GTAC;
+    int            c, i, n, line, dot, frames = 1000, wired = 0, print = 0, status = 0;
+
+    while ((c = getopt(argc, argv, "sw:n:p")) != -1) {
+        switch (c) {
+            case 's': order = ORDER_STANDARD; break;
+            case 'w': wired = 1; if (parse_wiring(optarg, cols) < 0) status = 2; break;
+            case 'n': frames = atoi(optarg); break;
+            case 'p': print = 1; break;
+            default:  status = 2; break;
+        }
+    }
+
+    if (status || optind != argc - 1 || frames < 1) {
+        fprintf(stderr, "usage: ls166 [-s] [-w H,G,F,E,D,C,B] [-n frames] [-p] image\n");
+        return 2;
+    }
+
+    if ((font = font_load(argv[optind], &len)) == NULL)
+        return 2;
+    glyphs = font_glyphs(len);
+    if (glyphs == 0) {
+        fprintf(stderr, "ls166: %s is shorter than one glyph\n", argv[optind]);
+        free(font);
+        return 2;
+    }
+
+    if (wired) {
+        // the ROM output left over from the seven pixels feeds A
+        for (flag = 0xff, i = 0; i < GLYPH_COLS; i++)
+            flag &= ~cols[i];
+        set_wiring(wiring, cols, flag);
+    }
+    else
+        pin_wiring(wiring, rom_pins[order]);
+
+    usec = 0;
+    for (n = 0; n < frames; n++) {
+        for (i = 0; i < TEXT_ROWS * TEXT_COLS; i++)
+            screen[i] = (unsigned char)(n * TEXT_ROWS * TEXT_COLS + i);
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        frame(font, glyphs, wiring);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        usec += (end.tv_sec - start.tv_sec) * 1e6 + (end.tv_nsec - start.tv_nsec) / 1e3;
+
+        if (n == 0 && print) {
+            for (line = 0; line < SCAN_LINES; line++) {
+                for (dot = 0; dot < DOTS; dot++)
+                    putchar(pixel(line, dot) ? '#' : ' ');
+                putchar('\n');
+            }
+        }
+
+        errors += check(font, glyphs, order);
+    }
+
+    // column test font: glyph k lights ROM output k+1 alone
+    for (i = 0; i < STAGES * GLYPH_ROWS; i++)
+        column_font[i] = (unsigned char)(1 << (i / GLYPH_ROWS));
+    for (i = 0; i < TEXT_ROWS * TEXT_COLS; i++)
+        screen[i] = (unsigned char)i;
+    frame(column_font, STAGES, wiring);
+    errors += check(column_font, STAGES, order);
+
+    fprintf(stderr, "ls166: %d frames, %.1f usec per frame, %zu pixel mismatches\n",
+            frames, usec / frames, errors);
+
+    free(font);
+    return errors ? 1 : 0;
+}
@@ -1,35 +1,409 @@
+/*
+ * reversebits.c
+ *
+ *  Convert Apple standard font rom images to the GTAC bit order.
+ *
+ *  usage: reversebits < in > out
+ *         reversebits [-j threads] -o outdir input ...
+ *         reversebits [-j threads] [-o outdir] -m manifest
+ *
+ *  With no arguments one image is converted from stdin to stdout.
+ *
+ *  In batch mode each input is a file or a directory of files, converted
+ *  to the same name in outdir; two inputs that would write the same file are
+ *  refused. A manifest lists one "input [output]" pair
+ *  per line; a missing output means outdir/name. Images are spread over a
+ *  pool of threads, each output is written to a temporary file and renamed
+ *  into place, and outputs that already hold the converted content are
+ *  left untouched.
+ *
+ *  build: cc -O2 -pthread -o reversebits reversebits.c
+ */
+
 #include <stdio.h>
- 
-// Function to fix bits of num to match hardware on gtac-2 clone
-unsigned int fixBits(unsigned char num)
+#include <errno.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <libgen.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "fontrom.h"
+
+typedef struct
+{
+    char       *in;
+    char       *out;
+    dev_t       dev;        // file the output names, see output_id()
+    ino_t       ino;
+    const char *leaf;
+} job_t;
+
+static job_t      *jobs;
+static size_t      job_count, job_size;
+static atomic_size_t job_next;
+static atomic_int  job_errors;
+static atomic_int  job_skipped;
+
+static const char *out_dir;
+
+static int add_job(const char *in, const char *out)
+{
+    job_t *tmp;
+    char  *name, *path;
+
+    if (out == NULL) {
+        if (out_dir == NULL) {
+            fprintf(stderr, "%s: no output directory given\n", in);
+            return -1;
+        }
+        name = strdup(in);
+        path = malloc(strlen(out_dir) + strlen(in) + 2);
+        if (name == NULL || path == NULL) {
+            free(name);
+            free(path);
+            return -1;
+        }
+        sprintf(path, "%s/%s", out_dir, basename(name));
+        free(name);
+    }
+    else if ((path = strdup(out)) == NULL)
+        return -1;
+
+    if (job_count == job_size) {
+        job_size = job_size ? job_size * 2 : 256;
+        tmp = realloc(jobs, job_size * sizeof(*jobs));
+        if (tmp == NULL) {
+            free(path);
+            return -1;
+        }
+        jobs = tmp;
+    }
+    jobs[job_count].in = strdup(in);
+    jobs[job_count].out = path;
+    if (jobs[job_count].in == NULL) {
+        free(path);
+        return -1;
+    }
+    job_count++;
+
+    return 0;
+}
+
+static int add_input(const char *in)
 {
-    unsigned char fixed = 0;
+    struct stat    st;
+    struct dirent *ent;
+    DIR           *dir;
+    char          *path;
+    int            result = 0;
+
+    if (stat(in, &st) < 0) {
+        perror(in);
+        return -1;
+    }
+
+    if (!S_ISDIR(st.st_mode))
+        return add_job(in, NULL);
 
-    /* test each bit of original and set appropriate in fixed */
-    if(num & 0x01) fixed |= 0x04;
-    if(num & 0x02) fixed |= 0x80;
-    if(num & 0x04) fixed |= 0x40;
-    if(num & 0x08) fixed |= 0x20;
-    if(num & 0x10) fixed |= 0x10;
-    if(num & 0x20) fixed |= 0x08;
-    if(num & 0x40) fixed |= 0x02;
-    if(num & 0x80) fixed |= 0x01;
+    if ((dir = opendir(in)) == NULL) {
+        perror(in);
+        return -1;
+    }
 
-    return fixed;
+    while (result == 0 && (ent = readdir(dir)) != NULL) {
+        if (ent->d_name[0] == '.')
+            continue;
+        if ((path = malloc(strlen(in) + strlen(ent->d_name) + 2)) == NULL) {
+            result = -1;
+            break;
+        }
+        sprintf(path, "%s/%s", in, ent->d_name);
+        if (stat(path, &st) == 0 && S_ISREG(st.st_mode))
+            result = add_job(path, NULL);
+        free(path);
+    }
+
+    closedir(dir);
+    return result;
 }
- 
-// Driver code
-int main()
+
+static int read_manifest(const char *manifest)
 {
-  unsigned char buf[1];
-  FILE * inputFileStream = stdin; 
-  FILE * outFileStream = stdout;
+    FILE *in;
+    char  line[4096], *src, *dst;
+
+    if ((in = fopen(manifest, "r")) == NULL) {
+        perror(manifest);
+        return -1;
+    }
 
-  while (!feof(inputFileStream)) {
-    fread(buf, 1, 1, inputFileStream);
-    buf[0] = fixBits(buf[0]);
-    if(!feof(inputFileStream))
-      fwrite(buf, 1, 1, outFileStream);
-  }
+    while (fgets(line, sizeof(line), in) != NULL) {
+        src = strtok(line, " \t\r\n");
+        if (src == NULL || src[0] == '#')
+            continue;
+        dst = strtok(NULL, " \t\r\n");
+        if (add_job(src, dst) < 0) {
+            fclose(in);
+            return -1;
+        }
+    }
+
+    fclose(in);
+    return 0;
 }
 
+/*
+ * output_id()
+ *
+ *  Identify the file a job's output names, so that "a.bin", "./a.bin" and
+ *  hard links compare equal. An existing output is its own dev/ino; one
+ *  not written yet is the dev/ino of its directory plus its last name.
+ */
+static int output_id(job_t *job)
+{
+    struct stat st;
+    char       *dir, *slash;
+    int         result;
+
+    if (stat(job->out, &st) == 0) {
+        job->dev = st.st_dev;
+        job->ino = st.st_ino;
+        job->leaf = "";
+        return 0;
+    }
+    if (errno != ENOENT) {
+        perror(job->out);
+        return -1;
+    }
+
+    if ((dir = strdup(job->out)) == NULL)
+        return -1;
+    if ((slash = strrchr(dir, '/')) == NULL) {
+        job->leaf = job->out;
+        result = stat(".", &st);
+    }
+    else {
+        job->leaf = job->out + (slash - dir) + 1;
+        slash[slash == dir] = '\0';
+        result = stat(dir, &st);
+    }
+    free(dir);
+
+    if (result < 0) {
+        perror(job->out);
+        return -1;
+    }
+    job->dev = st.st_dev;
+    job->ino = st.st_ino;
+    return 0;
+}
+
+static int job_out_cmp(const void *a, const void *b)
+{
+    const job_t *x = a, *y = b;
+
+    if (x->dev != y->dev)
+        return x->dev < y->dev ? -1 : 1;
+    if (x->ino != y->ino)
+        return x->ino < y->ino ? -1 : 1;
+    return strcmp(x->leaf, y->leaf);
+}
+
+/*
+ * check_outputs()
+ *
+ *  Reject the batch if two jobs write the same output, e.g. inputs with
+ *  the same name from different directories, as their workers would race
+ *  on one temporary file and rename. Sorts the jobs by output.
+ */
+static int check_outputs(void)
+{
+    size_t i;
+    int    result = 0;
+
+    for (i = 0; i < job_count; i++)
+        if (output_id(&jobs[i]) < 0)
+            result = -1;
+    if (result < 0)
+        return result;
+
+    qsort(jobs, job_count, sizeof(*jobs), job_out_cmp);
+
+    for (i = 1; i < job_count; i++) {
+        if (job_out_cmp(&jobs[i - 1], &jobs[i]) == 0) {
+            fprintf(stderr, "%s: output of both %s and %s\n",
+                    jobs[i].out, jobs[i - 1].in, jobs[i].in);
+            result = -1;
+        }
+    }
+
+    return result;
+}
+
+/*
+ * same_content()
+ *
+ *  Return 1 if the file already holds exactly len bytes of buf.
+ */
+static int same_content(const char *name, const unsigned char *buf, size_t len)
+{
+    unsigned char *old;
+    size_t         old_len;
+    FILE          *in;
+    int            same;
+
+    if ((in = fopen(name, "rb")) == NULL)
+        return 0;
+    old = font_read(in, &old_len);
+    fclose(in);
+
+    same = old != NULL && old_len == len && memcmp(old, buf, len) == 0;
+    free(old);
+
+    return same;
+}
+
+static int convert(size_t index)
+{
+    const job_t   *job = &jobs[index];
+    unsigned char *buf;
+    size_t         len;
+    char          *tmp;
+    FILE          *out;
+    int            result = -1;
+
+    if ((buf = font_load(job->in, &len)) == NULL)
+        return -1;
+
+    perm_buf(buf, len, PERM_FIX, PERM_SWAR);
+
+    if (same_content(job->out, buf, len)) {
+        atomic_fetch_add(&job_skipped, 1);
+        free(buf);
+        return 0;
+    }
+
+    if ((tmp = malloc(strlen(job->out) + 32)) != NULL) {
+        sprintf(tmp, "%s.%ld.%zu.tmp", job->out, (long)getpid(), index);
+        if ((out = fopen(tmp, "wb")) == NULL)
+            perror(tmp);
+        else if (fwrite(buf, 1, len, out) != len || fclose(out) != 0) {
+            perror(tmp);
+            remove(tmp);
+        }
+        else if (rename(tmp, job->out) < 0) {
+            perror(job->out);
+            remove(tmp);
+        }
+        else
+            result = 0;
+        free(tmp);
+    }
+
+    free(buf);
+    return result;
+}
+
+static void *worker(void *arg)
+{
+    size_t i;
+
+    (void)arg;
+
+    while ((i = atomic_fetch_add(&job_next, 1)) < job_count)
+        if (convert(i) < 0)
+            atomic_fetch_add(&job_errors, 1);
+
+    return NULL;
+}
+
+static int run_batch(int threads)
+{
+    pthread_t *tid;
+    int        i, started;
+
+    if ((size_t)threads > job_count)
+        threads = job_count ? (int)job_count : 1;
+    if ((tid = malloc(threads * sizeof(*tid))) == NULL)
+        return -1;
+
+    for (started = 0; started < threads; started++)
+        if (pthread_create(&tid[started], NULL, worker, NULL) != 0)
+            break;
+
+    // with no threads at all the main thread does the work
+    if (started == 0)
+        worker(NULL);
+
+    for (i = 0; i < started; i++)
+        pthread_join(tid[i], NULL);
+
+    free(tid);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    const char    *manifest = NULL;
+    unsigned char *buf;
+    size_t         len;
+    int            c, threads = 0, status = 0;
+
+    perm_init();
+
+    while ((c = getopt(argc, argv, "j:o:m:")) != -1) {
+        switch (c) {
+            case 'j': threads = atoi(optarg); break;
+            case 'o': out_dir = optarg; break;
+            case 'm': manifest = optarg; break;
+            default:  status = 2; break;
+        }
+    }
+
+    // an output directory only goes with inputs to write into it
+    if (out_dir != NULL && manifest == NULL && optind == argc)
+        status = 2;
+
+    if (status || threads < 0) {
+        fprintf(stderr, "usage: reversebits < in > out\n"
+                        "       reversebits [-j threads] -o outdir input ...\n"
+                        "       reversebits [-j threads] [-o outdir] -m manifest\n");
+        return 2;
+    }
+
+    // Single image from stdin to stdout
+    if (manifest == NULL && optind == argc) {
+        if ((buf = font_read(stdin, &len)) == NULL) {
+            fprintf(stderr, "reversebits: read error\n");
+            return 1;
+        }
+        perm_buf(buf, len, PERM_FIX, PERM_SWAR);
+        fwrite(buf, 1, len, stdout);
+        free(buf);
+        return 0;
+    }
+
+    if (manifest != NULL && read_manifest(manifest) < 0)
+        return 1;
+    for (; optind < argc; optind++)
+        if (add_input(argv[optind]) < 0)
+            return 1;
+
+    if (check_outputs() < 0)
+        return 1;
+
+    if (threads == 0)
+        threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads < 1)
+        threads = 1;
+
+    if (run_batch(threads) < 0)
+        return 1;
+
+    fprintf(stderr, "reversebits: %zu images, %d unchanged, %d failed\n",
+            job_count, atomic_load(&job_skipped), atomic_load(&job_errors));
+
+    return atomic_load(&job_errors) ? 1 : 0;
+}
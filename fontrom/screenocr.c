@@ -0,0 +1,508 @@
+/*
+ * screenocr.c
+ *
+ *  Recover the text page character codes from rendered or captured frames
+ *  of the 40 column text screen.
+ *
+ *  usage: screenocr [-s] [-x] [-e expected.hex] image frames
+ *         screenocr [-s] -t [-n frames] image
+ *
+ *  -s  image is in standard order instead of GTAC
+ *  -x  print the codes in hex instead of as text
+ *  -e  check every frame against the codes in expected.hex (24 lines of
+ *      40 hex codes, as printed by -x) instead of printing it
+ *  -t  self test: render frames of the test screen (as in ls166) in both
+ *      flash states, recognise them and check the result
+ *  -n  frames for the self test (default 1000)
+ *
+ *  frames holds one or more 280x192 frames back to back, either binary
+ *  PBM (P4) with set pixels black, e.g. a video capture scaled down to one
+ *  pixel per dot and thresholded with the netpbm tools, or 192 lines of
+ *  280 '#' and ' ' as printed by "ls166 -p". Each frame is printed as 24
+ *  lines of 40 characters followed by an empty line.
+ *
+ *  The frame is split into 960 cells of 7x8 pixels. The seven pixels of
+ *  each row are packed into 7 bits, so a cell is one 56-bit key, and the
+ *  key is looked up in an open addressing hash table built from the font.
+ *
+ *  Inverse and flash come from the ROM itself: the flag bit of a glyph
+ *  row (order_flag) feeds LS166 input A and the flash/inverse hardware,
+ *  which inverts that row steadily or on every other flash phase. The
+ *  table holds every glyph with its flagged rows inverted and, for glyphs
+ *  with a flag, also as plain pixels (flash off). Where several codes show
+ *  the same pixels the first one added wins, from $A0 up so the ASCII
+ *  codes come before the $80-$9F and $00-$7F codes of the same glyph.
+ *  One frame cannot tell a flashing cell from a steady one. Cells that
+ *  match no glyph print as '?' (hex "--") and are counted.
+ *
+ *  With -e a cell is right if the code read shows the same pixels as the
+ *  expected code in either flash state. frames/ls166_gtac.txt is the
+ *  first test screen of "ls166 -p lcrom_reverse.bin", made by the clock
+ *  model independently of the renderer here:
+ *
+ *      screenocr -e frames/ls166_gtac.hex lcrom_reverse.bin frames/ls166_gtac.txt
+ *
+ *  build: cc -O2 -o screenocr screenocr.c
+ */
+
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "fontrom.h"
+
+#define TEXT_COLS       40
+#define TEXT_ROWS       24
+#define SCAN_LINES      (TEXT_ROWS * GLYPH_ROWS)
+#define DOTS            (TEXT_COLS * GLYPH_COLS)
+#define CELLS           (TEXT_ROWS * TEXT_COLS)
+#define LINE_BYTES      ((DOTS + 7) / 8)
+#define STRIDE          (LINE_BYTES + 1)        // room to read two bytes past any cell
+
+#define ROW_MASK        0x7f
+#define TABLE_BITS      12
+#define TABLE_SIZE      (1 << TABLE_BITS)
+#define NO_CODE         (-1)
+
+typedef unsigned char frame_t[SCAN_LINES][STRIDE];
+
+static uint64_t table_key[TABLE_SIZE];
+static short    table_code[TABLE_SIZE];
+
+static unsigned table_slot(uint64_t key)
+{
+    return (unsigned)((key * UINT64_C(0x9e3779b97f4a7c15)) >> (64 - TABLE_BITS));
+}
+
+static int table_find(uint64_t key)
+{
+    unsigned slot = table_slot(key);
+
+    while (table_code[slot] != NO_CODE && table_key[slot] != key)
+        slot = (slot + 1) & (TABLE_SIZE - 1);
+    return table_code[slot];
+}
+
+/* first code added for a key stays */
+static void table_add(uint64_t key, int code)
+{
+    unsigned slot = table_slot(key);
+
+    while (table_code[slot] != NO_CODE && table_key[slot] != key)
+        slot = (slot + 1) & (TABLE_SIZE - 1);
+    if (table_code[slot] == NO_CODE) {
+        table_key[slot] = key;
+        table_code[slot] = (short)code;
+    }
+}
+
+/*
+ * glyph_key()
+ *
+ *  Pixels of a glyph as a cell key, first row in the top bits and the
+ *  leftmost pixel first within a row. *attr gets the rows whose flag bit
+ *  is set, as the key bits the flash/inverse hardware inverts.
+ */
+static uint64_t glyph_key(const unsigned char *font, size_t glyphs, int code, int order,
+                          uint64_t *attr)
+{
+    unsigned char byte;
+    uint64_t      key = 0;
+    int           y, x;
+
+    *attr = 0;
+    for (y = 0; y < GLYPH_ROWS; y++) {
+        byte = font[((size_t)code % glyphs) * GLYPH_ROWS + y];
+        for (x = 0; x < GLYPH_COLS; x++)
+            key = key << 1 | ((byte & order_cols[order][x]) != 0);
+        *attr = *attr << GLYPH_COLS | (byte & order_flag[order] ? ROW_MASK : 0);
+    }
+
+    return key;
+}
+
+// Codes in order of preference for glyphs that look the same: $A0-$FF, $80-$9F, $00-$7F
+static int code_at(int i)
+{
+    if (i < 0x60)
+        return 0xa0 + i;
+    if (i < 0x80)
+        return 0x80 + i - 0x60;
+    return i - 0x80;
+}
+
+/*
+ * table_init()
+ *
+ *  Add every code as shown with its flag rows inverted, then the flagged
+ *  codes in the flash off state.
+ */
+static void table_init(const unsigned char *font, size_t glyphs, int order)
+{
+    uint64_t key, attr;
+    int      i;
+
+    memset(table_code, 0xff, sizeof(table_code));
+
+    for (i = 0; i < 0x100; i++) {
+        key = glyph_key(font, glyphs, code_at(i), order, &attr);
+        table_add(key ^ attr, code_at(i));
+    }
+    for (i = 0; i < 0x100; i++) {
+        key = glyph_key(font, glyphs, code_at(i), order, &attr);
+        if (attr)
+            table_add(key, code_at(i));
+    }
+}
+
+/* pixels of one cell, packed as by glyph_key() */
+static uint64_t cell_key(const frame_t frame, int row, int col)
+{
+    const unsigned char *line;
+    uint64_t             key = 0;
+    int                  y, bit = col * GLYPH_COLS;
+
+    for (y = 0; y < GLYPH_ROWS; y++) {
+        line = frame[row * GLYPH_ROWS + y] + bit / 8;
+        key = key << GLYPH_COLS |
+              (((line[0] << 8 | line[1]) >> (16 - GLYPH_COLS - bit % 8)) & ROW_MASK);
+    }
+
+    return key;
+}
+
+/*
+ * recognise()
+ *
+ *  Look up every cell of a frame. Returns the number of unknown cells.
+ */
+static int recognise(const frame_t frame, short *screen)
+{
+    int row, col, unknown = 0;
+
+    for (row = 0; row < TEXT_ROWS; row++)
+        for (col = 0; col < TEXT_COLS; col++)
+            if ((*screen++ = (short)table_find(cell_key(frame, row, col))) == NO_CODE)
+                unknown++;
+
+    return unknown;
+}
+
+/*
+ * same_look()
+ *
+ *  Return 1 if two codes show the same pixels in some flash state.
+ */
+static int same_look(const unsigned char *font, size_t glyphs, int order, int a, int b)
+{
+    uint64_t key_a, key_b, attr_a, attr_b;
+
+    key_a = glyph_key(font, glyphs, a, order, &attr_a);
+    key_b = glyph_key(font, glyphs, b, order, &attr_b);
+
+    return key_a == key_b || (key_a ^ attr_a) == (key_b ^ attr_b) ||
+           (key_a ^ attr_a) == key_b || key_a == (key_b ^ attr_b);
+}
+
+/*
+ * render()
+ *
+ *  Draw a text page into a frame the way the video hardware shows it,
+ *  flagged rows inverted when flash is set.
+ */
+static void render(const unsigned char *font, size_t glyphs, int order,
+                   const unsigned char *screen, int flash, frame_t frame)
+{
+    uint64_t key, attr;
+    int      row, col, y, x, code, dot;
+
+    memset(frame, 0, sizeof(frame_t));
+    for (row = 0; row < TEXT_ROWS; row++) {
+        for (col = 0; col < TEXT_COLS; col++) {
+            code = screen[row * TEXT_COLS + col];
+            key = glyph_key(font, glyphs, code, order, &attr);
+            if (flash)
+                key ^= attr;
+            for (y = 0; y < GLYPH_ROWS; y++) {
+                for (x = 0; x < GLYPH_COLS; x++) {
+                    dot = col * GLYPH_COLS + x;
+                    if ((key >> ((GLYPH_ROWS - 1 - y) * GLYPH_COLS + GLYPH_COLS - 1 - x)) & 1)
+                        frame[row * GLYPH_ROWS + y][dot / 8] |= 0x80 >> (dot % 8);
+                }
+            }
+        }
+    }
+}
+
+/*
+ * pbm_number()
+ *
+ *  Read a number from a PBM header, skipping white space and '#' comments
+ *  before it. Returns -1 if there is none.
+ */
+static int pbm_number(FILE *in)
+{
+    int c, n;
+
+    while ((c = fgetc(in)) != EOF) {
+        if (c == '#') {
+            while ((c = fgetc(in)) != EOF && c != '\n')
+                ;
+        }
+        else if (c != ' ' && c != '\t' && c != '\r' && c != '\n')
+            break;
+    }
+    if (c == EOF || c < '0' || c > '9')
+        return -1;
+
+    for (n = 0; c >= '0' && c <= '9'; c = fgetc(in))
+        n = n * 10 + c - '0';
+
+    // the one white space character after the height ends the header
+    if (c == '#') {
+        while ((c = fgetc(in)) != EOF && c != '\n')
+            ;
+    }
+
+    return c == EOF ? -1 : n;
+}
+
+static int read_pbm(FILE *in, frame_t frame)
+{
+    int width, height, y;
+
+    if (fgetc(in) != 'P' || fgetc(in) != '4')
+        return -1;
+    width = pbm_number(in);
+    height = pbm_number(in);
+    if (width != DOTS || height != SCAN_LINES) {
+        fprintf(stderr, "screenocr: frame is %dx%d, expected %dx%d\n",
+                width, height, DOTS, SCAN_LINES);
+        return -1;
+    }
+
+    for (y = 0; y < SCAN_LINES; y++) {
+        if (fread(frame[y], 1, LINE_BYTES, in) != LINE_BYTES) {
+            fprintf(stderr, "screenocr: short frame\n");
+            return -1;
+        }
+    }
+
+    return 1;
+}
+
+static int read_text(FILE *in, frame_t frame)
+{
+    char line[DOTS + 8];
+    int  y, dot;
+
+    for (y = 0; y < SCAN_LINES; y++) {
+        if (fgets(line, sizeof(line), in) == NULL || strcspn(line, "\r\n") != DOTS) {
+            fprintf(stderr, "screenocr: scan line %d is not %d dots\n", y, DOTS);
+            return -1;
+        }
+        for (dot = 0; dot < DOTS; dot++)
+            if (line[dot] == '#')
+                frame[y][dot / 8] |= 0x80 >> (dot % 8);
+    }
+
+    return 1;
+}
+
+/*
+ * read_frame()
+ *
+ *  Read the next frame, PBM or text. Returns 1, 0 at the end of the file
+ *  or -1 on a bad frame.
+ */
+static int read_frame(FILE *in, frame_t frame)
+{
+    int c;
+
+    // blank lines between frames
+    while ((c = fgetc(in)) == '\n' || c == '\r')
+        ;
+    if (c == EOF)
+        return 0;
+    ungetc(c, in);
+
+    memset(frame, 0, sizeof(frame_t));
+    return c == 'P' ? read_pbm(in, frame) : read_text(in, frame);
+}
+
+static int read_expected(const char *name, size_t glyphs, short *screen)
+{
+    FILE     *in;
+    unsigned  code;
+    int       i;
+
+    if ((in = fopen(name, "r")) == NULL) {
+        perror(name);
+        return -1;
+    }
+    for (i = 0; i < CELLS; i++) {
+        if (fscanf(in, "%x", &code) != 1 || code > 0xff || code >= glyphs) {
+            fprintf(stderr, "%s: expected %d hex codes of glyphs in the image\n",
+                    name, CELLS);
+            fclose(in);
+            return -1;
+        }
+        screen[i] = (short)code;
+    }
+    fclose(in);
+
+    return 0;
+}
+
+static void print_screen(const short *screen, int hex)
+{
+    int row, col, code;
+
+    for (row = 0; row < TEXT_ROWS; row++) {
+        for (col = 0; col < TEXT_COLS; col++) {
+            code = screen[row * TEXT_COLS + col];
+            if (hex && code == NO_CODE)
+                printf("--%c", col < TEXT_COLS - 1 ? ' ' : '\n');
+            else if (hex)
+                printf("%02x%c", code, col < TEXT_COLS - 1 ? ' ' : '\n');
+            else if (code == NO_CODE)
+                putchar('?');
+            else
+                putchar((code & 0x7f) < 0x20 ? (code & 0x7f) + 0x40 : code & 0x7f);
+        }
+        if (!hex)
+            putchar('\n');
+    }
+    putchar('\n');
+}
+
+static double elapsed(const struct timespec *start, const struct timespec *end)
+{
+    return (end->tv_sec - start->tv_sec) * 1e6 + (end->tv_nsec - start->tv_nsec) / 1e3;
+}
+
+/*
+ * self_test()
+ *
+ *  Recognise rendered frames of the test screen and check that every
+ *  recognised code looks like the code drawn. Returns the number of
+ *  unknown and wrong cells.
+ */
+static size_t self_test(const unsigned char *font, size_t glyphs, int order, int frames)
+{
+    static frame_t  frame;
+    unsigned char   screen[CELLS];
+    short           codes[CELLS];
+    struct timespec start, end;
+    size_t          errors = 0, unknown = 0;
+    double          usec = 0;
+    int             n, i;
+
+    for (n = 0; n < frames; n++) {
+        for (i = 0; i < CELLS; i++)
+            screen[i] = (unsigned char)(n * CELLS + i);
+        render(font, glyphs, order, screen, n & 1, frame);
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        unknown += recognise(frame, codes);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        usec += elapsed(&start, &end);
+
+        for (i = 0; i < CELLS; i++) {
+            if (codes[i] != NO_CODE && !same_look(font, glyphs, order, screen[i], codes[i]) &&
+                errors++ < 10)
+                fprintf(stderr, "frame %d cell %d: code %02x read as %02x\n",
+                        n, i, screen[i], codes[i]);
+        }
+    }
+
+    fprintf(stderr, "screenocr: %d frames, %.1f usec per frame, %zu unknown cells, "
+                    "%zu wrong cells\n", frames, usec / frames, unknown, errors);
+    return errors + unknown;
+}
+
+int main(int argc, char **argv)
+{
+    static frame_t  frame;
+    unsigned char  *font;
+    const char     *expect_name = NULL;
+    short           codes[CELLS], expect[CELLS];
+    size_t          len, glyphs, errors = 0;
+    struct timespec start, end;
+    FILE           *in;
+    double          usec = 0;
+    int             c, i, got, frames = 1000, order = ORDER_GTAC, hex = 0, test = 0;
+    int             n = 0, unknown = 0, status = 0;
+
+    while ((c = getopt(argc, argv, "sxe:tn:")) != -1) {
+        switch (c) {
+            case 's': order = ORDER_STANDARD; break;
+            case 'x': hex = 1; break;
+            case 'e': expect_name = optarg; break;
+            case 't': test = 1; break;
+            case 'n': frames = atoi(optarg); break;
+            default:  status = 2; break;
+        }
+    }
+
+    if (status || optind != argc - (test ? 1 : 2) || frames < 1) {
+        fprintf(stderr, "usage: screenocr [-s] [-x] [-e expected.hex] image frames\n"
+                        "       screenocr [-s] -t [-n frames] image\n");
+        return 2;
+    }
+
+    if ((font = font_load(argv[optind], &len)) == NULL)
+        return 2;
+    if ((glyphs = font_glyphs(len)) == 0) {
+        fprintf(stderr, "screenocr: %s is shorter than one glyph\n", argv[optind]);
+        free(font);
+        return 2;
+    }
+    table_init(font, glyphs, order);
+
+    if (test) {
+        errors = self_test(font, glyphs, order, frames);
+        free(font);
+        return errors ? 1 : 0;
+    }
+
+    if (expect_name != NULL && read_expected(expect_name, glyphs, expect) < 0) {
+        free(font);
+        return 2;
+    }
+
+    if ((in = fopen(argv[optind + 1], "rb")) == NULL) {
+        perror(argv[optind + 1]);
+        free(font);
+        return 2;
+    }
+
+    while ((got = read_frame(in, frame)) > 0) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        unknown += recognise(frame, codes);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        usec += elapsed(&start, &end);
+
+        if (expect_name == NULL)
+            print_screen(codes, hex);
+        else {
+            for (i = 0; i < CELLS; i++) {
+                if (codes[i] != NO_CODE &&
+                    !same_look(font, glyphs, order, expect[i], codes[i]) && errors++ < 10)
+                    fprintf(stderr, "frame %d cell %d: code %02x read as %02x\n",
+                            n, i, expect[i], codes[i]);
+            }
+        }
+        n++;
+    }
+    fclose(in);
+
+    if (n)
+        fprintf(stderr, "screenocr: %d frames, %.1f usec per frame, %d unknown cells%s",
+                n, usec / n, unknown, expect_name ? "" : "\n");
+    if (n && expect_name)
+        fprintf(stderr, ", %zu wrong cells\n", errors);
+
+    free(font);
+    return got < 0 ? 2 : unknown || errors ? 1 : 0;
+}
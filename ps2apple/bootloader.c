@@ -0,0 +1,315 @@
+/*
+ * bootloader.c
+ *
+ *  Serial bootloader for the PS2 keyboard interface ATtiny84.
+ *  It lives in the top 1K of flash and takes new application firmware
+ *  over a single wire serial link on the spare PB2 pin, so the board does
+ *  not have to be pulled and put on an ISP programmer.
+ *
+ * Flash layout (words)
+ *
+ *  0x0000 - 0x0DFE  application, vector 0 patched to 'rjmp 0x0E00'
+ *  0x0DFF           'rjmp' to the application's reset code
+ *  0x0E00 - 0x0FFF  bootloader
+ *
+ *  The ATtiny84 has no boot reset fuse, so the uploader patches the
+ *  application's reset vector to jump here and moves the original jump to
+ *  the last word below the bootloader. The bootloader refuses a page 0
+ *  that does not keep that vector, and never writes its own pages.
+ *
+ * Entry
+ *
+ *  At reset PB2 is read once with its pull-up on. If it is high the
+ *  application starts right away, which only adds a few uSec to the
+ *  application's start up. If the uploader is holding the line low (a
+ *  serial break) through reset, or there is no application, the
+ *  bootloader waits for commands. PB3 stays the reset pin so ISP still
+ *  works; the uploader can pulse it through DTR.
+ *
+ * Serial link
+ *
+ *  Half duplex, 57600 baud 8N1, bit banged on PB2 as an open drain line
+ *  with the pull-up as the idle level. The host's TX drives the line
+ *  through a diode (cathode to TX) and its RX reads it, so the host also
+ *  reads back what it sends.
+ *
+ * Commands, CRCs are CRC-16/CCITT as in <util/crc16.h>, low byte first
+ *
+ *  'I'                  -> 'B' page size, application pages
+ *  'C' page             -> CRC of the page as in flash
+ *  'W' page data crc    -> 'K' written and read back, '!' rejected
+ *  'X'                  -> 'K' and start the application
+ *
+ *  Only pages whose CRC differs need to be sent; the uploader does this.
+ *
+ * Status
+ *
+ *  Not yet tested on hardware. BIT_LOOP is an estimate of the cycles the
+ *  bit loops spend outside the delay, not measured from the compiled
+ *  code; check the bit time with a scope (or calibrate BIT_LOOP) before
+ *  relying on 57600 baud.
+ *
+ *  build:
+ *      avr-gcc -mmcu=attiny84 -DF_CPU=8000000UL -Os -nostartfiles \
+ *              -Wl,--section-start=.text=0x1c00 -o bootloader.elf bootloader.c
+ *  fuses: SELFPRGEN must be programmed (efuse 0xFE)
+ *
+ */
+
+#include    <stdint.h>
+
+#include    <avr/io.h>
+#include    <avr/boot.h>
+#include    <avr/pgmspace.h>
+#include    <avr/wdt.h>
+#include    <util/crc16.h>
+
+// Flash layout
+#define     BOOT_START      0x1c00      // Byte address of the bootloader
+#define     APP_PAGES       (BOOT_START / SPM_PAGESIZE)
+#define     APP_JUMP        (BOOT_START - 2)    // Byte address of the application jump
+#define     RJMP_BOOT       (0xc000 | ((BOOT_START / 2 - 1) & 0x0fff))
+
+typedef void (*app_t)(void);
+
+#define     app()           ((app_t)(APP_JUMP / 2))()   // Function pointers are word addresses
+
+// Serial line on PB2
+#define     BOOT_LINE       0b00000100
+#define     BOOT_BAUD       57600
+#define     BIT_CYCLES      (F_CPU / BOOT_BAUD)
+#define     BIT_LOOP        12          // Estimated cycles of the bit loop around the delay, uncalibrated
+
+// Replies
+#define     BOOT_ID         'B'
+#define     BOOT_OK         'K'
+#define     BOOT_ERR        '!'
+#define     BOOT_UNKNOWN    '?'
+
+/****************************************************************************
+  Function prototypes
+****************************************************************************/
+void    boot(void) __attribute__((naked)) __attribute__((section(".vectors")));
+void    boot_main(void) __attribute__((OS_main)) __attribute__((noreturn)) __attribute__((used));
+
+static uint8_t  line_recv(void);
+static void     line_send(uint8_t);
+static uint16_t page_crc(uint16_t);
+static uint8_t  page_write(uint8_t, const uint8_t *);
+
+/* ----------------------------------------------------------------------------
+ * boot()
+ *
+ *  Reset entry, reached through the patched reset vector.
+ *  There are no start files, so the zero register and stack are set here
+ *  in asm; a naked function has no frame, so the C code with its locals
+ *  is in boot_main().
+ *
+ */
+void boot(void)
+{
+    asm volatile (
+        "clr    __zero_reg__    \n\t"
+        "ldi    r28, lo8(%0)    \n\t"
+        "ldi    r29, hi8(%0)    \n\t"
+        "out    __SP_L__, r28   \n\t"
+        "out    __SP_H__, r29   \n\t"
+        "rjmp   boot_main       \n\t"
+        :: "i" (RAMEND)
+    );
+}
+
+/* ----------------------------------------------------------------------------
+ * boot_main()
+ *
+ *  Start the application, or take commands from the uploader.
+ *
+ */
+void boot_main(void)
+{
+    uint8_t     page_buffer[SPM_PAGESIZE];
+    uint16_t    crc;
+    uint8_t     command, page, i;
+
+    // Sample PB2 with its pull-up, allow the pin a few uSec to settle
+    PORTB |= BOOT_LINE;
+    __builtin_avr_delay_cycles(32);
+
+    if ( (PINB & BOOT_LINE) && pgm_read_word(APP_JUMP) != 0xffff )
+    {
+        PORTB &= ~BOOT_LINE;
+        app();
+    }
+
+    // Stay in the bootloader, at 8MHz with the watch dog off
+    MCUSR = 0;
+    wdt_disable();
+    CLKPR = 0x80;
+    CLKPR = 0x00;
+
+    // Wait for the end of the break
+    while ( !(PINB & BOOT_LINE) );
+
+    while ( 1 )
+    {
+        command = line_recv();
+
+        switch ( command )
+        {
+            case 'I':
+                line_send(BOOT_ID);
+                line_send(SPM_PAGESIZE);
+                line_send(APP_PAGES);
+                break;
+
+            case 'C':
+                crc = page_crc(line_recv());
+                line_send((uint8_t)crc);
+                line_send((uint8_t)(crc >> 8));
+                break;
+
+            case 'W':
+                page = line_recv();
+                crc = 0xffff;
+                for ( i = 0; i < SPM_PAGESIZE; i++ )
+                {
+                    page_buffer[i] = line_recv();
+                    crc = _crc_ccitt_update(crc, page_buffer[i]);
+                }
+                crc ^= line_recv();
+                crc ^= (uint16_t)line_recv() << 8;
+
+                if ( crc == 0 && page_write(page, page_buffer) )
+                    line_send(BOOT_OK);
+                else
+                    line_send(BOOT_ERR);
+                break;
+
+            case 'X':
+                line_send(BOOT_OK);
+                app();
+                break;
+
+            default:
+                line_send(BOOT_UNKNOWN);
+        }
+    }
+}
+
+/* ----------------------------------------------------------------------------
+ * page_crc()
+ *
+ *  CRC of an application page as it is in flash.
+ *
+ *  param:  page number
+ *  return: CRC
+ */
+static uint16_t page_crc(uint16_t page)
+{
+    uint16_t    address = page * SPM_PAGESIZE;
+    uint16_t    crc = 0xffff;
+    uint8_t     i;
+
+    for ( i = 0; i < SPM_PAGESIZE; i++ )
+        crc = _crc_ccitt_update(crc, pgm_read_byte(address + i));
+
+    return crc;
+}
+
+/* ----------------------------------------------------------------------------
+ * page_write()
+ *
+ *  Erase and write one application page, then read it back.
+ *  The bootloader pages and a page 0 without the bootloader reset vector
+ *  are rejected. The CPU is halted while the page is erased and written.
+ *
+ *  param:  page number, page data
+ *  return: 1 written and verified, 0 rejected or failed
+ */
+static uint8_t page_write(uint8_t page, const uint8_t *data)
+{
+    uint16_t    address = page * SPM_PAGESIZE;
+    uint8_t     i;
+
+    if ( page >= APP_PAGES )
+        return 0;
+    if ( page == 0 && (data[0] | (data[1] << 8)) != RJMP_BOOT )
+        return 0;
+
+    boot_page_erase(address);
+    boot_spm_busy_wait();
+
+    for ( i = 0; i < SPM_PAGESIZE; i += 2 )
+        boot_page_fill(address + i, data[i] | (data[i + 1] << 8));
+
+    boot_page_write(address);
+    boot_spm_busy_wait();
+
+    for ( i = 0; i < SPM_PAGESIZE; i++ )
+        if ( pgm_read_byte(address + i) != data[i] )
+            return 0;
+
+    return 1;
+}
+
+/* ----------------------------------------------------------------------------
+ * line_recv()
+ *
+ *  Receive a byte on PB2: wait for the start bit, sample the data bits
+ *  in their middle, LSB first.
+ *
+ *  param:  none
+ *  return: data byte
+ */
+static uint8_t line_recv(void)
+{
+    uint8_t     byte = 0;
+    uint8_t     i;
+
+    while ( PINB & BOOT_LINE );
+
+    __builtin_avr_delay_cycles(BIT_CYCLES + BIT_CYCLES / 2 - BIT_LOOP);
+
+    for ( i = 0; i < 8; i++ )
+    {
+        byte >>= 1;
+        if ( PINB & BOOT_LINE )
+            byte |= 0x80;
+        __builtin_avr_delay_cycles(BIT_CYCLES - BIT_LOOP);
+    }
+
+    // the stop bit is still in progress, the start bit wait skips it
+
+    return byte;
+}
+
+/* ----------------------------------------------------------------------------
+ * line_send()
+ *
+ *  Send a byte on PB2. A '0' drives the line low, a '1' releases it to
+ *  the pull-up.
+ *
+ *  param:  data byte
+ *  return: none
+ */
+static void line_send(uint8_t byte)
+{
+    uint16_t    frame = ((uint16_t)byte << 1) | 0x200;     // start bit 0, stop bit 1
+    uint8_t     i;
+
+    for ( i = 0; i < 10; i++ )
+    {
+        if ( frame & 1 )
+        {
+            DDRB &= ~BOOT_LINE;
+            PORTB |= BOOT_LINE;
+        }
+        else
+        {
+            PORTB &= ~BOOT_LINE;
+            DDRB |= BOOT_LINE;
+        }
+        frame >>= 1;
+        __builtin_avr_delay_cycles(BIT_CYCLES - BIT_LOOP);
+    }
+}
@@ -0,0 +1,335 @@
+/*
+ * decode_test.c
+ *
+ *  Host regression and fuzz test of the firmware's keyboard byte stream
+ *  decoder (kbd_decode.h).
+ *
+ *  usage: decode_test [-n streams] [-s seed]
+ *
+ *  -n  random streams to fuzz after the regression cases (default 1000000)
+ *  -s  seed of the stream generator (default 1)
+ *
+ *  The regression cases are byte streams with the codes the main loop
+ *  must be handed, including truncated and stray prefixes. "T" in a case
+ *  is the line staying idle for longer than KBD_SEQ_TIMEOUT.
+ *
+ *  Each fuzz stream is up to 16 bytes, mostly prefixes and the codes that
+ *  follow them, fed in set 1 or set 3 mode. After the stream a plain key
+ *  make code must come out within KBD_MAX_LATENCY bytes, and at once after
+ *  a time out, whatever state the stream left.
+ *
+ *  The fuzzer is coverage guided: a stream that reaches a decoder (mode,
+ *  state, byte) transition not seen before is kept in a corpus, which
+ *  starts from the regression case inputs, and half of the streams are
+ *  mutations of a corpus entry (byte changed, inserted, dropped, or a
+ *  splice with another entry). A stream that breaks the latency rule is
+ *  cut down to the bytes it needs and printed as a case line, with the
+ *  codes it produced, to add to the table once the fix is in. The number
+ *  of transitions seen and the corpus size are reported as coverage.
+ *
+ *  build: cc -O2 -o decode_test decode_test.c
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// host stand-ins for <avr/pgmspace.h>
+#define PROGMEM
+#define pgm_read_byte(p)    (*(const uint8_t *)(p))
+
+#include "kbd_decode.h"
+
+#define T               0x100       // idle past KBD_SEQ_TIMEOUT
+#define END             (-2)
+#define MAX_BYTES       16
+#define KBD_MAX_LATENCY 2           // bytes a prefix may hold back a following key
+
+#define SET1_KEY        0x1e        // 'A' make, set 1
+#define SET3_KEY        0x1c        // 'A' make, set 3
+
+typedef struct
+{
+    const char *name;
+    int         set3;
+    int         in[MAX_BYTES];      // bytes or T, ends with END
+    int         out[MAX_BYTES];     // codes handed to the main loop, ends with END
+} test_case_t;
+
+static const test_case_t cases[] =
+{
+    { "pause/break",        0, { 0xe1, 0x1d, 0x45, 0xe1, 0x9d, 0xc5, 0x1e, END }, { 0x1e, END } },
+    { "arrows",             0, { 0xe0, 0x4b, 0xe0, 0xcb, 0xe0, 0x4d, END },      { 55, 56, END } },
+    { "right ctrl",         0, { 0xe0, 0x1d, 0xe0, 0x9d, END },                  { 0x1d, 0x9d, END } },
+    { "prtscrn",            0, { 0xe0, 0x2a, 0xe0, 0x37, 0xe0, 0xb7, 0xe0, 0xaa, 0x1e, END },
+                                                                                 { 0x1e, END } },
+    { "e0 f0 break",        0, { 0xe0, 0xf0, 0x1e, END },                        { 0x1e, END } },
+    { "e0 truncated",       0, { 0xe0, T, 0x1e, END },                           { 0x1e, END } },
+    { "e1 truncated",       0, { 0xe1, T, 0x1e, END },                           { 0x1e, END } },
+    { "e1 1d truncated",    0, { 0xe1, 0x1d, T, 0x1e, END },                     { 0x1e, END } },
+    { "e1 lost 1d",         0, { 0xe1, 0x45, 0x1e, END },                        { 0x45, 0x1e, END } },
+    { "e0 e0",              0, { 0xe0, 0xe0, 0x4b, END },                        { 0x4b, END } },
+    { "set 3 make/break",   1, { 0x1c, 0xf0, 0x1c, 0x12, 0xf0, 0x12, END },     { 0x1e, 0x9e, 0x2a, 0xaa, END } },
+    { "set 3 stray f0",     1, { 0xf0, T, 0x1c, END },                           { 0x1e, END } },
+    { "set 3 f0 f0",        1, { 0xf0, 0xf0, 0x1c, END },                        { 0, 0x1e, END } },
+    { "set 3 unused key",   1, { 0x80, 0x07, END },                              { 0, 0x3b, END } },
+};
+
+#define CORPUS_SIZE     4096
+
+typedef struct
+{
+    int set3;
+    int len;
+    int in[MAX_BYTES];
+} stream_t;
+
+static uint8_t  coverage[2][8][T + 1];     // mode, state, byte or T
+static int      covered;
+static stream_t corpus[CORPUS_SIZE];
+static int      corpus_count;
+
+static int feed(int byte)
+{
+    uint8_t *seen = &coverage[kbd_set3 & 1][kbd_seq & 7][byte];
+
+    if (!*seen) {
+        *seen = 1;
+        covered++;
+    }
+
+    if (byte == T) {
+        kbd_decode_expire(KBD_SEQ_TIMEOUT + 1);
+        return -1;
+    }
+
+    return kbd_decode(byte);
+}
+
+static void reset(int set3)
+{
+    kbd_set3 = (uint8_t)set3;
+    kbd_seq = KBD_SEQ_NONE;
+}
+
+static void print_bytes(const int *in, int len)
+{
+    int i;
+
+    for (i = 0; i < len; i++)
+        printf(in[i] == T ? "T, " : "0x%02x, ", in[i]);
+}
+
+static void add_corpus(const stream_t *st)
+{
+    if (corpus_count < CORPUS_SIZE)
+        corpus[corpus_count++] = *st;
+}
+
+static int run_case(const test_case_t *tc)
+{
+    int i, code, n = 0, errors = 0;
+
+    reset(tc->set3);
+    for (i = 0; tc->in[i] != END; i++) {
+        if ((code = feed(tc->in[i])) == -1)
+            continue;
+        if (tc->out[n] == END || tc->out[n] != code)
+            errors++;
+        else
+            n++;
+    }
+    if (tc->out[n] != END)
+        errors++;
+
+    if (errors)
+        printf("FAIL %s\n", tc->name);
+
+    return errors != 0;
+}
+
+static uint32_t rand_state;
+
+static uint32_t next_rand(void)
+{
+    rand_state = rand_state * 1664525u + 1013904223u;
+    return rand_state >> 8;
+}
+
+// mostly prefixes and the bytes that follow them
+static int random_byte(void)
+{
+    static const int interesting[] =
+    {
+        0xe0, 0xe1, 0xf0, 0x1d, 0x9d, 0x45, 0xc5, 0x4b, 0x4d, 0x2a, 0xaa, 0x37, 0xb7, T
+    };
+    uint32_t r = next_rand();
+
+    if (r % 4 == 0)
+        return (int)(r >> 8) & 0xff;
+    return interesting[(r >> 8) % (sizeof(interesting) / sizeof(interesting[0]))];
+}
+
+/*
+ * mutate()
+ *
+ *  Make a new stream from a corpus entry: change, insert or drop a byte,
+ *  or splice the start of the entry with the end of another one.
+ */
+static void mutate(stream_t *st)
+{
+    const stream_t *other;
+    int             i, at;
+
+    *st = corpus[next_rand() % corpus_count];
+    at = (int)(next_rand() % (st->len + 1));
+
+    switch (next_rand() % 4) {
+        case 0:
+            if (at < st->len)
+                st->in[at] = random_byte();
+            break;
+        case 1:
+            if (st->len < MAX_BYTES) {
+                for (i = st->len; i > at; i--)
+                    st->in[i] = st->in[i - 1];
+                st->in[at] = random_byte();
+                st->len++;
+            }
+            break;
+        case 2:
+            if (at < st->len && st->len > 1) {
+                for (i = at; i < st->len - 1; i++)
+                    st->in[i] = st->in[i + 1];
+                st->len--;
+            }
+            break;
+        default:
+            other = &corpus[next_rand() % corpus_count];
+            for (i = (int)(next_rand() % (other->len + 1)); i < other->len && at < MAX_BYTES; i++)
+                st->in[at++] = other->in[i];
+            st->len = at > 0 ? at : 1;
+            break;
+    }
+}
+
+/*
+ * stalls()
+ *
+ *  Feed a stream, then check a plain key gets through, once by itself
+ *  and once after a time out. Returns 1 if it is held back too long.
+ */
+static int stalls(int set3, const int *in, int len)
+{
+    int key = set3 ? SET3_KEY : SET1_KEY;
+    int i, seq;
+
+    reset(set3);
+    for (i = 0; i < len; i++)
+        feed(in[i]);
+    seq = kbd_seq;
+
+    for (i = 0; i <= KBD_MAX_LATENCY; i++)
+        if (feed(key) == SET1_KEY)
+            break;
+    if (i > KBD_MAX_LATENCY)
+        return 1;
+
+    kbd_seq = (uint8_t)seq;
+    feed(T);
+    return feed(key) != SET1_KEY;
+}
+
+/*
+ * print_stall()
+ *
+ *  Drop the bytes a stalling stream does not need, then print it with
+ *  the following key as a case line, with the codes that came out.
+ */
+static void print_stall(stream_t st)
+{
+    stream_t shorter;
+    int      i, n, code, key = st.set3 ? SET3_KEY : SET1_KEY;
+
+    for (i = 0; i < st.len && st.len > 1; ) {
+        shorter = st;
+        memmove(&shorter.in[i], &shorter.in[i + 1], (shorter.len - i - 1) * sizeof(int));
+        shorter.len--;
+        if (stalls(shorter.set3, shorter.in, shorter.len))
+            st = shorter;
+        else
+            i++;
+    }
+
+    printf("stall: { \"fuzz\", %d, { ", st.set3);
+    print_bytes(st.in, st.len);
+    printf("0x%02x, END }, { ", key);
+
+    reset(st.set3);
+    for (i = 0, n = 0; i <= st.len; i++)
+        if ((code = feed(i < st.len ? st.in[i] : key)) != -1 && n++ < MAX_BYTES)
+            printf("0x%02x, ", code);
+    printf("END } },\n");
+}
+
+int main(int argc, char **argv)
+{
+    struct timespec start, end;
+    double          sec;
+    long            streams = 1000000, n, found = 0;
+    stream_t        st;
+    int             c, i, before, failed = 0, status = 0;
+
+    rand_state = 1;
+    while ((c = getopt(argc, argv, "n:s:")) != -1) {
+        switch (c) {
+            case 'n': streams = atol(optarg); break;
+            case 's': rand_state = (uint32_t)strtoul(optarg, NULL, 0); break;
+            default:  status = 2; break;
+        }
+    }
+    if (status || optind != argc || streams < 0) {
+        fprintf(stderr, "usage: decode_test [-n streams] [-s seed]\n");
+        return 2;
+    }
+
+    for (i = 0; i < (int)(sizeof(cases) / sizeof(cases[0])); i++) {
+        failed += run_case(&cases[i]);
+
+        // the case inputs seed the corpus
+        st.set3 = cases[i].set3;
+        for (st.len = 0; st.len < MAX_BYTES && cases[i].in[st.len] != END; st.len++)
+            st.in[st.len] = cases[i].in[st.len];
+        add_corpus(&st);
+    }
+    printf("decode_test: %d of %d cases failed\n", failed, i);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (n = 0; n < streams; n++) {
+        if (next_rand() & 1)
+            mutate(&st);
+        else {
+            st.set3 = (int)(next_rand() & 1);
+            st.len = (int)(next_rand() % MAX_BYTES) + 1;
+            for (i = 0; i < st.len; i++)
+                st.in[i] = random_byte();
+        }
+
+        before = covered;
+        if (stalls(st.set3, st.in, st.len) && found++ < 10)
+            print_stall(st);
+        if (covered > before)
+            add_corpus(&st);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    sec = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    printf("decode_test: %ld streams, %.1f M streams/s, %ld stalls, %d transitions seen, "
+           "corpus %d\n", streams, sec > 0 ? streams / sec / 1e6 : 0, found, covered,
+           corpus_count);
+
+    return failed || found ? 1 : 0;
+}
@@ -0,0 +1,173 @@
+/*
+ * kbd_decode.h
+ *
+ *  Keyboard byte stream decoder, shared by the firmware (ps2apple.c) and
+ *  the host regression test (decode_test.c). Everything here is static,
+ *  so each still builds from a single source file. The includer provides
+ *  <stdint.h>, PROGMEM and pgm_read_byte() (<avr/pgmspace.h> or stubs).
+ *
+ *  The decoder never waits for a byte: it is fed one byte per call and
+ *  keeps the state of a multi byte sequence in kbd_seq between calls.
+ *
+ */
+
+#ifndef KBD_DECODE_H
+#define KBD_DECODE_H
+
+#define     KBD_SEQ_TIMEOUT 10000       // uSec, a prefix with no following byte for this long is dropped
+#define     KBD_BREAK       0xF0        // Set 3 break prefix, PS2_KH_BREAK
+
+typedef enum
+{
+    KBD_SEQ_NONE,
+    KBD_SEQ_E0,             // set 1 'E0' seen
+    KBD_SEQ_E1,             // set 1 'E1' seen
+    KBD_SEQ_E1_LAST,        // set 1 'E1' and '1D' or '9D' seen
+    KBD_SEQ_BREAK           // set 3 'F0' seen
+} kbd_seq_t;
+
+static uint8_t  kbd_set3 = 0;           // keyboard is in set 3 make-only mode
+static uint8_t  kbd_seq = KBD_SEQ_NONE; // kbd_seq_t of a multi byte sequence in progress
+
+// Set 3 to set 1 make code translation, for the keys the Apple II uses
+// Left and Right arrows go to 55 and 56 as in the set 1 'E0' handling,
+// F1 to F10 are kept for the macros
+static const uint8_t set3_xlate[107] PROGMEM =
+{
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x3b, // 00
+    0x01, 0x00, 0x00, 0x00, 0x00, 0x0f, 0x29, 0x3c, // 08
+    0x00, 0x1d, 0x2a, 0x00, 0x00, 0x10, 0x02, 0x3d, // 10
+    0x00, 0x00, 0x2c, 0x1f, 0x1e, 0x11, 0x03, 0x3e, // 18
+    0x00, 0x2e, 0x2d, 0x20, 0x12, 0x05, 0x04, 0x3f, // 20
+    0x00, 0x39, 0x2f, 0x21, 0x14, 0x13, 0x06, 0x40, // 28
+    0x00, 0x31, 0x30, 0x23, 0x22, 0x15, 0x07, 0x41, // 30
+    0x00, 0x00, 0x32, 0x24, 0x16, 0x08, 0x09, 0x42, // 38
+    0x00, 0x33, 0x25, 0x17, 0x18, 0x0b, 0x0a, 0x43, // 40
+    0x00, 0x34, 0x35, 0x26, 0x27, 0x19, 0x0c, 0x44, // 48
+    0x00, 0x00, 0x28, 0x00, 0x1a, 0x0d, 0x00, 0x00, // 50
+    0x1d, 0x36, 0x1c, 0x1b, 0x2b, 0x00, 0x00, 0x00, // 58
+    0x00, 0x37, 0x00, 0x00, 0x00, 0x00, 0x0e, 0x00, // 60
+    0x00, 0x00, 0x38                                // 68
+};
+
+/* ----------------------------------------------------------------------------
+ * kbd_set3_xlate()
+ *
+ *  Translate a set 3 code to the set 1 make code of the same key.
+ *  The 'F0' break prefix is handled by kbd_decode().
+ *
+ *  param:  set 3 code
+ *  return: set 1 code, 0 for keys with no Apple II use
+ */
+static int kbd_set3_xlate(int scan_code)
+{
+    if ( scan_code >= (int)sizeof(set3_xlate) )
+        return 0;
+
+    return pgm_read_byte(&set3_xlate[scan_code]);
+}
+
+/* ----------------------------------------------------------------------------
+ * kbd_decode()
+ *
+ *  Decode the keyboard's byte stream one byte at a time into set 1 codes
+ *  of an 83 key keyboard, without waiting for the rest of a sequence:
+ *
+ *  set 1:  'E0' Right Ctrl is passed as Ctrl, 'E0' Left and Right arrows
+ *          go to 55 and 56, all other 'E0' keys (including the PrtScrn
+ *          E0,2A,E0,37 and E0,B7,E0,AA halves) are discarded.
+ *          The Pause/Break E1,1D,45 and E1,9D,C5 halves are discarded.
+ *  set 3:  'F0' and the key's code are returned as a set 1 break code.
+ *
+ *  A lost or truncated sequence costs at most the next byte, and
+ *  kbd_decode_expire() drops a prefix left waiting.
+ *
+ *  param:  byte from the keyboard
+ *  return: set 1 code, 0 for set 3 keys with no Apple II use,
+ *          -1 if the byte was consumed by a sequence
+ */
+static int kbd_decode(int scan_code)
+{
+    uint8_t seq = kbd_seq;
+
+    kbd_seq = KBD_SEQ_NONE;
+
+    switch ( seq )
+    {
+        case KBD_SEQ_BREAK:
+            scan_code = kbd_set3_xlate(scan_code);
+            return scan_code ? (scan_code | 0x80) : 0;
+
+        case KBD_SEQ_E1:
+            /* Get the next (3rd) byte and discard sequence
+             */
+            if ( scan_code == 0x1d || scan_code == 0x9d )
+            {
+                kbd_seq = KBD_SEQ_E1_LAST;
+                return -1;
+            }
+            break;
+
+        case KBD_SEQ_E1_LAST:
+            return -1;
+
+        case KBD_SEQ_E0:
+            /* Right Ctrl same as Left Ctrl, retain both 'make' and 'break'
+             */
+            if ( scan_code == 0x1d || scan_code == 0x9d )
+                return scan_code;
+
+            /* Left and right arrow keys captured
+             * are remapped.
+             */
+            if ( scan_code == 0x4b )
+                return 55;
+            if ( scan_code == 0x4d )
+                return 56;
+
+            /* Discard all the rest including break codes
+             */
+            return -1;
+    }
+
+    if ( kbd_set3 )
+    {
+        if ( scan_code == KBD_BREAK )
+        {
+            kbd_seq = KBD_SEQ_BREAK;
+            return -1;
+        }
+
+        return kbd_set3_xlate(scan_code);
+    }
+
+    if ( scan_code == 0xe0 )
+    {
+        kbd_seq = KBD_SEQ_E0;
+        return -1;
+    }
+    if ( scan_code == 0xe1 )
+    {
+        kbd_seq = KBD_SEQ_E1;
+        return -1;
+    }
+
+    return scan_code;
+}
+
+/* ----------------------------------------------------------------------------
+ * kbd_decode_expire()
+ *
+ *  Drop a pending sequence prefix once the line has been idle for longer
+ *  than KBD_SEQ_TIMEOUT.
+ *
+ *  param:  uSec since the last PS2 clock edge
+ *  return: none
+ */
+static void kbd_decode_expire(uint16_t idle)
+{
+    if ( idle > KBD_SEQ_TIMEOUT )
+        kbd_seq = KBD_SEQ_NONE;
+}
+
+#endif /* KBD_DECODE_H */
@@ -0,0 +1,180 @@
+/*
+ * macro.c
+ *
+ *  Encode keystroke macros into an EEPROM image for ps2apple.
+ *
+ *  usage: macro [-o macros.eep] macros.txt
+ *
+ *  Each input line "Fn text" sets the macro typed by function key Fn
+ *  (F1 to F10). In the text "\n" is RETURN, "\e" is ESC, "^X" is
+ *  Control-X, and "\\" and "\^" are a plain backslash and caret. Lower
+ *  case is typed as upper case. Blank lines and lines starting with '#'
+ *  are skipped.
+ *
+ *  Key codes are stored as 7 bits, and runs matching a word of the
+ *  dictionary in macro_dict.h are stored as one byte, longest match
+ *  first. The image is written raw (default macros.eep) for e.g.
+ *  "avrdude -U eeprom:w:macros.eep:r", and the packed size is reported
+ *  against one byte per key.
+ *
+ *  build: cc -O2 -o macro macro.c
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "macro_dict.h"
+
+#define EEPROM_SIZE     512
+#define MACRO_MAX       MACRO_EEPROM_SIZE
+
+static const char  dict[] = MACRO_DICT;
+static const char *words[MACRO_LAST - MACRO_WORD];
+static int         word_count;
+
+static void dict_init(void)
+{
+    const char *p;
+
+    for (p = dict; p < dict + sizeof(dict) - 1 && *p; p += strlen(p) + 1)
+        words[word_count++] = p;
+}
+
+/*
+ * keys()
+ *
+ *  Turn the text of a macro into key codes, high bit dropped. Returns the
+ *  number of keys or -1 on a bad escape.
+ */
+static int keys(const char *text, char *out)
+{
+    int n = 0;
+
+    for (; *text && *text != '\n' && *text != '\r' && n < MACRO_MAX; text++) {
+        if (*text == '\\') {
+            switch (*++text) {
+                case 'n':  out[n++] = 0x0d; break;
+                case 'e':  out[n++] = 0x1b; break;
+                case '\\': out[n++] = '\\'; break;
+                case '^':  out[n++] = '^'; break;
+                default:   return -1;
+            }
+        }
+        else if (*text == '^') {
+            if (*++text < '@' || toupper((unsigned char)*text) > '_' || *text == '@')
+                return -1;
+            out[n++] = toupper((unsigned char)*text) & 0x1f;
+        }
+        else
+            out[n++] = toupper((unsigned char)*text) & 0x7f;
+    }
+
+    return n;
+}
+
+/*
+ * encode()
+ *
+ *  Pack key codes, replacing the longest dictionary word at each point by
+ *  its token. Returns the packed length.
+ */
+static int encode(const char *in, int len, unsigned char *out)
+{
+    int i = 0, n = 0, w, best, best_len, wlen;
+
+    while (i < len) {
+        best = -1;
+        best_len = 1;
+        for (w = 0; w < word_count; w++) {
+            wlen = (int)strlen(words[w]);
+            if (wlen > best_len && wlen <= len - i && memcmp(in + i, words[w], wlen) == 0) {
+                best = w;
+                best_len = wlen;
+            }
+        }
+
+        if (best >= 0) {
+            out[n++] = (unsigned char)(MACRO_WORD + best);
+            i += best_len;
+        }
+        else
+            out[n++] = (unsigned char)in[i++];
+    }
+
+    return n;
+}
+
+int main(int argc, char **argv)
+{
+    static char    text[MACRO_COUNT][MACRO_MAX];
+    static int     text_len[MACRO_COUNT];
+    unsigned char  image[EEPROM_SIZE], packed[MACRO_MAX];
+    const char    *out_name = "macros.eep";
+    char           line[1024], *p;
+    FILE          *in, *out;
+    int            i, key, len, used = 0, raw = 0, last = -1, line_no = 0;
+
+    if (argc == 4 && strcmp(argv[1], "-o") == 0) {
+        out_name = argv[2];
+        argv += 2;
+        argc -= 2;
+    }
+    if (argc != 2) {
+        fprintf(stderr, "usage: macro [-o macros.eep] macros.txt\n");
+        return 2;
+    }
+
+    if ((in = fopen(argv[1], "r")) == NULL) {
+        perror(argv[1]);
+        return 1;
+    }
+
+    dict_init();
+
+    while (fgets(line, sizeof(line), in) != NULL) {
+        line_no++;
+        if (line[0] == '#' || line[0] == '\n' || line[0] == '\r')
+            continue;
+
+        if (toupper((unsigned char)line[0]) != 'F' ||
+            (key = (int)strtol(line + 1, &p, 10)) < 1 || key > MACRO_COUNT || *p != ' ' ||
+            (len = keys(p + 1, text[key - 1])) < 0) {
+            fprintf(stderr, "%s:%d: bad macro line\n", argv[1], line_no);
+            fclose(in);
+            return 1;
+        }
+        text_len[key - 1] = len;
+        if (key - 1 > last)
+            last = key - 1;
+    }
+    fclose(in);
+
+    // macros back to back up to the last one defined, each ends with MACRO_END
+    memset(image, MACRO_LAST, sizeof(image));
+    for (i = 0; i <= last; i++) {
+        len = encode(text[i], text_len[i], packed);
+        if (used + len + 1 > MACRO_EEPROM_SIZE) {
+            fprintf(stderr, "macro: F%d does not fit, %d bytes left\n", i + 1,
+                    MACRO_EEPROM_SIZE - used - 1);
+            return 1;
+        }
+        memcpy(image + used, packed, len);
+        used += len;
+        image[used++] = MACRO_END;
+        raw += text_len[i] + 1;
+
+        if (text_len[i])
+            fprintf(stderr, "F%-2d %3d keys -> %3d bytes\n", i + 1, text_len[i], len);
+    }
+
+    if ((out = fopen(out_name, "wb")) == NULL ||
+        fwrite(image, 1, sizeof(image), out) != sizeof(image) || fclose(out) != 0) {
+        perror(out_name);
+        return 1;
+    }
+
+    fprintf(stderr, "macro: %d bytes of %d used, %d unpacked\n", used, MACRO_EEPROM_SIZE, raw);
+    return 0;
+}
@@ -0,0 +1,51 @@
+/*
+ * macro_dict.h
+ *
+ *  Keyword dictionary for the keystroke macros kept in EEPROM, shared by
+ *  the firmware (ps2apple.c) and the host encoder (macro.c).
+ *
+ *  Macro bytes in EEPROM:
+ *
+ *  0x00         end of this macro
+ *  0x01 - 0x7F  one Apple II key code with the high bit dropped
+ *  0x80 - 0xFE  the dictionary word with index (byte - 0x80)
+ *  0xFF         end of all macros (erased EEPROM)
+ *
+ *  The dictionary is the Applesoft keywords longer than one character and
+ *  the DOS 3.3 commands, each terminated by a zero. Words are only ever
+ *  added at the end, so EEPROM images made by an older encoder still
+ *  decode. At most 127 words.
+ *
+ */
+
+#ifndef MACRO_DICT_H
+#define MACRO_DICT_H
+
+#define     MACRO_END       0x00
+#define     MACRO_WORD      0x80
+#define     MACRO_LAST      0xff
+#define     MACRO_COUNT     10          // F1 to F10
+#define     MACRO_EEPROM_SIZE 510       // of 512, the last word holds the PS2 clock period
+
+#define     MACRO_DICT                                                          \
+    "END\0"     "FOR\0"     "NEXT\0"    "DATA\0"    "INPUT\0"   "DEL\0"         \
+    "DIM\0"     "READ\0"    "GR\0"      "TEXT\0"    "PR#\0"     "IN#\0"         \
+    "CALL\0"    "PLOT\0"    "HLIN\0"    "VLIN\0"    "HGR2\0"    "HGR\0"         \
+    "HCOLOR=\0" "HPLOT\0"   "DRAW\0"    "XDRAW\0"   "HTAB\0"    "HOME\0"        \
+    "ROT=\0"    "SCALE=\0"  "SHLOAD\0"  "TRACE\0"   "NOTRACE\0" "NORMAL\0"      \
+    "INVERSE\0" "FLASH\0"   "COLOR=\0"  "POP\0"     "VTAB\0"    "HIMEM:\0"      \
+    "LOMEM:\0"  "ONERR\0"   "RESUME\0"  "RECALL\0"  "STORE\0"   "SPEED=\0"      \
+    "LET\0"     "GOTO\0"    "RUN\0"     "IF\0"      "RESTORE\0" "GOSUB\0"       \
+    "RETURN\0"  "REM\0"     "STOP\0"    "ON\0"      "WAIT\0"    "LOAD\0"        \
+    "SAVE\0"    "DEF\0"     "POKE\0"    "PRINT\0"   "CONT\0"    "LIST\0"        \
+    "CLEAR\0"   "GET\0"     "NEW\0"     "TAB(\0"    "TO\0"      "FN\0"          \
+    "SPC(\0"    "THEN\0"    "AT\0"      "NOT\0"     "STEP\0"    "AND\0"         \
+    "OR\0"      "SGN\0"     "INT\0"     "ABS\0"     "USR\0"     "FRE\0"         \
+    "SCRN(\0"   "PDL\0"     "POS\0"     "SQR\0"     "RND\0"     "LOG\0"         \
+    "EXP\0"     "COS\0"     "SIN\0"     "TAN\0"     "ATN\0"     "PEEK\0"        \
+    "LEN\0"     "STR$\0"    "VAL\0"     "ASC\0"     "CHR$\0"    "LEFT$\0"       \
+    "RIGHT$\0"  "MID$\0"    "CATALOG\0" "BLOAD\0"   "BRUN\0"    "BSAVE\0"       \
+    "LOCK\0"    "UNLOCK\0"  "DELETE\0"  "RENAME\0"  "OPEN\0"    "CLOSE\0"       \
+    "WRITE\0"   "APPEND\0"  "VERIFY\0"  "EXEC\0"    "MAXFILES\0" "CALL -151\0"
+
+#endif /* MACRO_DICT_H */
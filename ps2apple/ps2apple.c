@@ -50,7 +50,8 @@
  * Note: all references to data sheet are for ATtiny84 8006K–AVR–10/10
  *
  * TODO:
- * 1) Keyboard error handling and recovery.
+ * 1) Keyboard error handling and recovery (receive errors now recover on the
+ *    next frame after a frame timeout).
  * 2) Apple II 'REPT' ket not implemented.
  *
  */
@@ -59,9 +60,28 @@
 #include    <stdlib.h>
 
 #include    <avr/io.h>
+#include    <avr/pgmspace.h>
 #include    <avr/interrupt.h>
 #include    <avr/wdt.h>
+#include    <avr/eeprom.h>
+#include    <avr/power.h>
+#include    <avr/sleep.h>
 #include    <util/delay.h>
+#include    <util/atomic.h>
+
+#include    "macro_dict.h"
+#include    "kbd_decode.h"
+
+// System clock scaler (sec 8.12.2 p.37)
+// the CPU sleeps in idle mode at 2MHz and runs at 8MHz from the first PS2 clock edge of
+// a frame until the scan code is handled. Timer1 counts and _delay_xx() are only valid at 8MHz.
+#define     CLOCK_FAST      clock_div_1 // 8MHz
+#define     CLOCK_IDLE      clock_div_4 // 2MHz
+#define     CLKPR_FAST      0x00        // clk/1, for the receive ISR entry stub
+
+// GPIO registers used by the receive ISR entry stub
+#define     GPIOR_PINS      GPIOR0      // port B as sampled on entry
+#define     GPIOR_SAVE      GPIOR1      // r24 while the stub runs
 
 // IO ports B, C, and D initialization
 #define     PA_DDR_INIT     0xff        // Port data direction
@@ -76,6 +96,29 @@
 #define     GIMSK_INIT      0b00100000  // Enable pin change sensing on PCINT8..11
 #define     PCMSK1_INIT     0x01        // Enable pin change interrupt on PB0 -> PCINT8
 
+// Timer1 free running time base for PS2 clock edge time stamps
+// (input capture pin ICP1 is PA7, which drives the Apple strobe, so edges
+//  are time stamped by reading TCNT1 in the pin change ISR)
+#define     TCCR1A_INIT     0x00        // Normal mode
+#define     TCCR1B_INIT     0b00000010  // clk/8, 1uSec per count at 8MHz
+#define     TIMSK1_INIT     0b00000001  // Overflow interrupt wakes the idle loop for the watch-dog
+
+// PS2 clock period estimate in uSec, keyboards run at 10 to 16.7KHz
+#define     PS2_CLK_PERIOD_INIT  100    // Start assuming the slowest rate, 10KHz
+#define     PS2_CLK_PERIOD_MIN   40     // Shorter or longer edge intervals
+#define     PS2_CLK_PERIOD_MAX   130    // are not used for the estimate
+#define     PS2_INHIBIT_MIN      100    // Minimum clock inhibit before host send
+#define     PS2_FRAME_PERIODS    4      // No clock edge for this many periods abandons a frame,
+#define     PS2_FRAME_TIMEOUT_MAX 2000  // but never wait longer than the spec limit of 2mSec
+#define     PS2_SEND_START_TIMEOUT 15000 // Keyboard starts clocking a host send within 15mSec
+
+#define     ps2_frame_timeout(period)   ((period) < PS2_FRAME_TIMEOUT_MAX / PS2_FRAME_PERIODS ? \
+                                         (period) * PS2_FRAME_PERIODS : PS2_FRAME_TIMEOUT_MAX)
+
+// EEPROM cell holding the clock period measured at start up, read it with
+// "avrdude -U eeprom:r:-:h"; the macros use the bytes below it
+#define     EE_CLK_PERIOD   ((uint16_t *)MACRO_EEPROM_SIZE)
+
 // PS2 control line masks
 #define     PS2_CLOCK       0x01
 #define     PS2_DATA        0x02
@@ -98,7 +141,7 @@
 #define     PS2_HK_DEFAULT  0xF6    // Set Default
 #define     PS2_HK_SET1     0xF7    // Set All Keys - Typematic
 #define     PS2_HK_SET2     0xF8    // Set All Keys - Make/Break
-#define     PS2_HK_SET3     0xF8    // Set All Keys - Make
+#define     PS2_HK_SET3     0xF9    // Set All Keys - Make
 #define     PS2_HK_SET4     0xFA    // Set All Keys - Typematic/Make/Break
 #define     PS2_HK_SET5     0xFB    // Set All Key Type - Typematic, next byte Scan code
 #define     PS2_HK_SET6     0xFC    // Set All Key Type - Make/Break, next byte Scan code
@@ -112,6 +155,13 @@
 
 #define     PS2_HK_TYPEMAT  0b01111111  // 1Sec delay, 2Hz repetition
 
+// Scan code set 3 make-only mode
+// all keys send make codes only, Shift and Ctrl also send break codes,
+// so a key stroke is one frame instead of the two (or more) of set 1.
+// keys do not repeat in this mode, so it is off by default. set to 1 to use it
+// on keyboards that support set 3, others stay in set 1.
+#define     KBD_SET3        0
+
 // Keyboard to Host commands
 #define     PS2_KH_ERR23    0x00    // Key Detection Error/Overrun (Code Sets 2 and 3)
 #define     PS2_KH_BATOK    0xAA    // BAT Completion Code
@@ -122,7 +172,15 @@
 #define     PS2_KH_RESEND   0xFE    // Resend
 #define     PS2_KH_ERR1     0xFF    // Key Detection Error/Overrun (Code Set 1)
 
+// Set 1 make codes of the macro keys
+#define     SCAN_F1         0x3b
+#define     SCAN_F10        0x44
+
+// Keystroke macros
+#define     MACRO_CR_DELAY  100     // mSec after a RETURN, for the line to be taken in
+
 // Apple II keyboard
+#define     APPLE_CR        0x8d
 #define     KBNA            0b00000000
 #define     CTRL            0b00000001
 #define     SHFT            0b00000010
@@ -147,41 +205,66 @@ typedef enum
 ****************************************************************************/
 void    reset(void) __attribute__((naked)) __attribute__((section(".init3")));
 void    ioinit(void);
+void    timer_wait(uint16_t);
+int     ps2_clock_wait(uint8_t, uint16_t);
 
 int     ps2_send(uint8_t);
 int     ps2_recv_x(void);       // Blocking
 int     ps2_recv(void);         // Non-blocking
+void    ps2_inhibit(void);
+void    ps2_release(void);
 
 void    kbd_test_led(void);
 int     kdb_led_ctrl(uint8_t);
 int     kbd_code_set(int);
+int     kbd_code_set_get(void);
+int     kbd_set3_make_only(void);
+void    kbd_decode_timeout(void);
 int     kbd_typematic_set(uint8_t);
 
+void    macro_play(uint8_t);
+void    macro_word(uint8_t);
+void    macro_key(uint8_t);
+
 void    apple_kbd_write(int code, uint8_t shift_ctrl_flags);
+void    apple_kbd_put(uint8_t);
 void    apple_kbd_stb(void);
 
 /****************************************************************************
   Globals
 ****************************************************************************/
 // Circular buffer holding PS2 scan codes
-uint8_t      ps2_scan_codes[PS2_BUFF_SIZE];
-int          ps2_buffer_out = 0;
-volatile int ps2_buffer_in = 0;
-volatile int ps2_scan_code_count = 0;
+// 8-bit indexes and count so the ISR and main loop use single byte operations
+uint8_t          ps2_scan_codes[PS2_BUFF_SIZE];
+uint8_t          ps2_buffer_out = 0;
+volatile uint8_t ps2_buffer_in = 0;
+volatile uint8_t ps2_scan_code_count = 0;
+
+// PS2 clock edge timing in Timer1 counts (uSec)
+// ps2_clk_period is the running estimate of the keyboard's bit period, used
+// to size the host send inhibit and the frame time out. it never rejects a frame
+// by itself, only a gap of more than ps2_frame_timeout() does
+volatile uint16_t ps2_clk_last = 0;
+volatile uint16_t ps2_clk_period = PS2_CLK_PERIOD_INIT;
 
 // Variable maintaining state of bit stream from PS2
-volatile ps2_state_t ps2_rx_state = PS2_IDLE;
+// state holds a ps2_state_t, kept in a byte as an enum is 16-bit on AVR
+volatile uint8_t  ps2_rx_state = PS2_IDLE;
 volatile uint8_t  ps2_rx_data_byte = 0;
-volatile int      ps2_rx_bit_count = 0;
-volatile int      ps2_rx_parity = 0;
+volatile uint8_t  ps2_rx_bit_count = 0;
+volatile uint8_t  ps2_rx_parity = 0;
 
 // PS2 keyboard status
 volatile uint8_t    kbd_lock_keys = 0;
 
+// Function keys held down, bit 0 for F1, so a held key plays its macro once
+uint16_t macro_keys_down = 0;
+
 // Shift status and scan code translation tables
+// the tables are read from flash, they would otherwise take 232 of the 512 bytes of SRAM
 uint8_t shift_ctrl_state = KBNA;
 
-uint8_t scan_code_xlate[4][58] =
+const uint8_t scan_code_xlate[4][58] PROGMEM =
 {
     /* Normal codes
      */
@@ -232,13 +315,18 @@ uint8_t scan_code_xlate[4][58] =
     }
 };
 
+// Macro keyword dictionary
+const char macro_dict[] PROGMEM = MACRO_DICT;
+
 /* ----------------------------------------------------------------------------
  * main() control functions
  *
  */
 int main(void)
 {
-    int     scan_code;
+    int         scan_code;
+    uint16_t    temp_period;
+    uint16_t    macro_bit;
 
     // Initialize IO devices
     ioinit();
@@ -246,21 +334,36 @@ int main(void)
     // Wait enough time for keyboard to complete self test
     _delay_ms(1000);
 
+    // Enable interrupts, keyboard responses are received by the ISR
+    sei();
+
     // Light LEDs in succession
     kbd_test_led();
 
     // Set typematic delay and rate
     kbd_typematic_set(PS2_HK_TYPEMAT);
 
-    // Change code set to "1" so code set translation does not needs to take place on the AVR
-    kbd_code_set(1);
+    /* Try set 3 make-only mode, which halves the frames per key stroke.
+     * Otherwise change code set to "1" so code set translation does not needs to take place on the AVR
+     */
+    if ( KBD_SET3 && kbd_set3_make_only() == PS2_KH_ACK )
+        kbd_set3 = 1;
+    else
+        kbd_code_set(1);
 
     // Caps lock on as power indicator
     kdb_led_ctrl(PS2_HK_CAPSLOCK);
 
+    // the acknowledge frames of the set up commands have settled the clock period
+    // estimate, keep it where it can be read back (written only when it changed)
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        temp_period = ps2_clk_period;
+    }
+    eeprom_update_word(EE_CLK_PERIOD, temp_period);
+
     // Start watch-dog timer here after.
     wdt_enable(WDTO_500MS);
-    sei();
 
     // loop forever
     while ( 1 )
@@ -272,65 +375,29 @@ int main(void)
 
         scan_code = ps2_recv();
 
-        /* Only pass make and break codes for keys in range 1 to 83
-         * Handle 'E0' modifier for keypad by removing the 'E0' which
-         * will effectively reduce any keyboard to one that is equivalent to an 83 key keyboard.
-         * Discard PrtScrn E0,2A,E0,37 and E0,B7,E0,AA.
-         * dISCARD E1 sequence of Pause/Break.
+        /* Only pass make and break codes for keys in range 1 to 83,
+         * kbd_decode() reduces any keyboard to one that is equivalent to an 83 key keyboard.
          */
         if  ( scan_code != -1 )
         {
-            /* Handle 'E1' scan code case for Pause/Break key
+            /* The keyboard's own buffer overflowed, e.g. while it was held off during
+             * a macro, and break codes may have been lost: release Shift, Ctrl and
+             * the function keys rather than leave one stuck down
              */
-            if ( scan_code == 0xe1 )
+            if ( scan_code == (kbd_set3 ? PS2_KH_ERR23 : PS2_KH_ERR1) )
             {
-                scan_code = ps2_recv_x();
-
-                /* Get the next (3rd) byte and discard sequence
-                 */
-                if ( scan_code == 0x1d )
-                {
-                    ps2_recv_x();
-                    continue;
-                }
-                else if ( scan_code == 0x9d )
-                {
-                    ps2_recv_x();
-                    continue;
-                }
+                shift_ctrl_state = KBNA;
+                macro_keys_down = 0;
+                kbd_seq = KBD_SEQ_NONE;
+                continue;
             }
 
-            /* Handle 'E0' scan code cases
+            /* Fold prefixed sequences into a single set 1 code,
+             * bytes that only advance a sequence are consumed here
              */
-            if ( scan_code == 0xe0 )
-            {
-                scan_code = ps2_recv_x();
-
-                /* Right Ctrl same as Left Ctrl, retain both 'make' and 'break'
-                 */
-                if ( scan_code == 0x1d ||
-                     scan_code == 0x9d    )
-                {
-                    // Do nothing.
-                }
-                /* Left and right arrow keys captured
-                 * are remapped.
-                 */
-                else if ( scan_code == 0x4b )
-                {
-                    scan_code = 55;
-                }
-                else if ( scan_code == 0x4d )
-                {
-                    scan_code = 56;
-                }
-                /* Discard all the rest including break codes
-                 */
-                else
-                {
-                    continue;
-                }
-            }
+            scan_code = kbd_decode(scan_code);
+            if ( scan_code == -1 )
+                continue;
 
             /* Detect state of Shift and Ctrl keys
              */
@@ -357,6 +424,32 @@ int main(void)
                 continue;
             }
 
+            /* Function keys F1 to F10 type the macros kept in EEPROM, once per key press.
+             * Typematic repeats of a held key are ignored until its break code; in set 3
+             * make-only mode keys neither repeat nor break, so every make is a press.
+             * The keyboard is held off while a macro types, so it keeps the keys pressed
+             * meanwhile in its own buffer instead of overflowing the receive ring.
+             */
+            if ( scan_code >= SCAN_F1 && scan_code <= SCAN_F10 )
+            {
+                macro_bit = 1 << (scan_code - SCAN_F1);
+                if ( !(macro_keys_down & macro_bit) )
+                {
+                    if ( !kbd_set3 )
+                        macro_keys_down |= macro_bit;
+
+                    ps2_inhibit();
+                    macro_play(scan_code - SCAN_F1);
+                    ps2_release();
+                }
+                continue;
+            }
+            else if ( scan_code >= (SCAN_F1 | 0x80) && scan_code <= (SCAN_F10 | 0x80) )
+            {
+                macro_keys_down &= ~(1 << (scan_code - (SCAN_F1 | 0x80)));
+                continue;
+            }
+
             /* Now it is safe to ignore unwanted scan codes
              * including all 'Break' codes
              */
@@ -378,6 +471,34 @@ int main(void)
             if ( scan_code > 0 )
                 apple_kbd_write(scan_code, shift_ctrl_state);
         }
+        else if ( kbd_seq != KBD_SEQ_NONE )
+        {
+            /* A sequence is waiting for its next byte, stay at full speed
+             * so the time out is checked against a Timer1 running at 1uSec per count
+             */
+            kbd_decode_timeout();
+        }
+        else
+        {
+            /* Nothing to do, slow the CPU and sleep until the next PS2 clock edge.
+             * The check, the scaler change and the sleep are done with interrupts off,
+             * as a start bit arriving in between would otherwise leave the ISR's clock
+             * restore overwritten, or leave the CPU asleep with a byte in the buffer.
+             * sei() takes effect after the next instruction, so no interrupt can come
+             * between it and sleep_cpu(). The Timer1 overflow wakes the loop at least
+             * every 262mSec to reset the watch-dog.
+             */
+            cli();
+            if ( ps2_scan_code_count == 0 && ps2_rx_state == PS2_IDLE )
+            {
+                clock_prescale_set(CLOCK_IDLE);
+                sleep_enable();
+                sei();
+                sleep_cpu();
+                sleep_disable();
+            }
+            sei();
+        }
     }
 
     return 0;
@@ -411,8 +532,8 @@ void reset(void)
 void ioinit(void)
 {
     // Reconfigure system clock scaler to 8MHz
-    CLKPR = 0x80;   // change clock scaler (sec 8.12.2 p.37)
-    CLKPR = 0x00;
+    clock_prescale_set(CLOCK_FAST);
+    set_sleep_mode(SLEEP_MODE_IDLE);
 
     // initialize general IO PB and PD pins
     DDRB  = ~PB_DDR_INIT;
@@ -423,11 +544,54 @@ void ioinit(void)
     DDRA  = PA_DDR_INIT;
     PORTA = PA_INIT | PA_PUP_INIT;
 
+    // Timer1 time base
+    TCCR1A = TCCR1A_INIT;
+    TCCR1B = TCCR1B_INIT;
+    TIMSK1 = TIMSK1_INIT;
+
     // pin change interrupt setting
     GIMSK = GIMSK_INIT;
     PCMSK1 = PCMSK1_INIT;
 }
 
+/* ----------------------------------------------------------------------------
+ * timer_wait()
+ *
+ *  Busy wait on Timer1. Reading TCNT1 uses the shared 16-bit TEMP register,
+ *  so only call this while the PS2 receive ISR is masked.
+ *
+ *  param:  wait time in uSec, up to 65535
+ *  return: none
+ */
+void timer_wait(uint16_t usec)
+{
+    uint16_t    start = TCNT1;
+
+    do {} while ( (uint16_t)(TCNT1 - start) < usec );
+}
+
+/* ----------------------------------------------------------------------------
+ * ps2_clock_wait()
+ *
+ *  Wait for the PS2 clock line to reach a level, giving up after a time out.
+ *  Like timer_wait(), only call this while the PS2 receive ISR is masked.
+ *
+ *  param:  PS2_CLOCK to wait for high, 0 for low, time out in uSec
+ *  return: -1 time out, 0 ok
+ */
+int ps2_clock_wait(uint8_t level, uint16_t usec)
+{
+    uint16_t    start = TCNT1;
+
+    while ( (PINB & PS2_CLOCK) != level )
+    {
+        if ( (uint16_t)(TCNT1 - start) >= usec )
+            return -1;
+    }
+
+    return 0;
+}
+
 /* ----------------------------------------------------------------------------
  * ps2_send_cmd()
  *
@@ -451,22 +615,31 @@ void ioinit(void)
  */
 int ps2_send(uint8_t byte)
 {
-    int     ps2_tx_parity = 1;
-    int     ps2_tx_bit_count = 0;
-    uint8_t ps2_data_bit;
-    int     result;
-
-    // disable interrupts and reset receiver state so receive ISR does not run
-    cli();
+    int      ps2_tx_parity = 1;
+    int      ps2_tx_bit_count = 0;
+    uint8_t  ps2_data_bit;
+    uint16_t inhibit, timeout, limit;
+    int      result = -1;
+
+    /* mask the PS2 clock pin change interrupt and reset receiver state so receive ISR does not run.
+     * only this one interrupt source is masked, interrupts stay globally enabled.
+     */
+    PCMSK1 &= ~PCMSK1_INIT;
     ps2_rx_state = PS2_IDLE;
     ps2_rx_data_byte = 0;
     ps2_rx_bit_count = 0;
     ps2_rx_parity = 0;
 
-    // follow byte send steps
+    // follow byte send steps, inhibit for at least two clock periods of this keyboard
+    // the receive ISR is masked, so the period can be read without holding interrupts off
+    inhibit = 2 * ps2_clk_period;
+    if ( inhibit < PS2_INHIBIT_MIN )
+        inhibit = PS2_INHIBIT_MIN;
+    timeout = ps2_frame_timeout(ps2_clk_period);
+
     DDRB |= PS2_CLOCK;
     PORTB &= ~PS2_CLOCK;
-    _delay_us(100);
+    timer_wait(inhibit);
 
     DDRB |= PS2_DATA;
     PORTB &= ~PS2_DATA;
@@ -474,6 +647,11 @@ int ps2_send(uint8_t byte)
     DDRB &= ~PS2_CLOCK;
     PORTB |= PS2_CLOCK;
 
+    /* the keyboard starts clocking within 15mSec of the request to send,
+     * after that each clock edge must come within the frame time out,
+     * so a keyboard that stops clocking fails the send instead of hanging it
+     */
+    limit = PS2_SEND_START_TIMEOUT;
     while ( ps2_tx_bit_count < 10 )
     {
         // this will repeat 8 bits of data, one parity bit, and one stop bit for transmission
@@ -491,14 +669,17 @@ int ps2_send(uint8_t byte)
             ps2_data_bit = 1;
         }
 
-        do {} while ( (PINB & PS2_CLOCK) );
+        if ( ps2_clock_wait(0, limit) )
+            break;
+        limit = timeout;
 
         if ( ps2_data_bit )
             PORTB |= PS2_DATA;
         else
             PORTB &= ~PS2_DATA;
 
-        do {} while ( !(PINB & PS2_CLOCK) );
+        if ( ps2_clock_wait(PS2_CLOCK, timeout) )
+            break;
 
         ps2_tx_bit_count++;
         byte = byte >> 1;
@@ -509,12 +690,18 @@ int ps2_send(uint8_t byte)
     PORTB |= PS2_DATA;
 
     // check here for ACK pulse and line to idle
-    do {} while ( (PINB & PS2_CLOCK) );
-    result = -1 * (int)(PINB & PS2_DATA);
+    if ( ps2_tx_bit_count == 10 && ps2_clock_wait(0, timeout) == 0 )
+    {
+        result = -1 * (int)(PINB & PS2_DATA);
 
-    // wait for clock to go high before enabling interrupts
-    do {} while ( !(PINB & PS2_CLOCK) );
-    sei();
+        // wait for clock to go high before enabling the receive interrupt
+        if ( ps2_clock_wait(PS2_CLOCK, timeout) )
+            result = -1;
+    }
+
+    // discard the pin changes flagged while transmitting
+    GIFR = (1 << PCIF1);
+    PCMSK1 |= PCMSK1_INIT;
 
     // allow keyboard to recover before exiting,
     // so that another ps2_send() is spaced in time from this call.
@@ -560,7 +747,13 @@ int ps2_recv(void)
     if ( ps2_scan_code_count > 0 )
     {
         result = (int)ps2_scan_codes[ps2_buffer_out];
-        ps2_scan_code_count--;
+
+        // the ISR also updates the count, so decrement it with the ISR held off
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+        {
+            ps2_scan_code_count--;
+        }
+
         ps2_buffer_out++;
         if ( ps2_buffer_out == PS2_BUFF_SIZE )
             ps2_buffer_out = 0;
@@ -569,6 +762,46 @@ int ps2_recv(void)
     return result;
 }
 
+/* ----------------------------------------------------------------------------
+ * ps2_inhibit()
+ *
+ *  Hold the PS2 clock low so the keyboard keeps its scan codes until
+ *  ps2_release(). A frame cut short is sent again by the keyboard, so the
+ *  receiver drops what it has of it.
+ *
+ *  param:  none
+ *  return: none
+ */
+void ps2_inhibit(void)
+{
+    PCMSK1 &= ~PCMSK1_INIT;
+    ps2_rx_state = PS2_IDLE;
+    ps2_rx_data_byte = 0;
+    ps2_rx_bit_count = 0;
+    ps2_rx_parity = 0;
+
+    DDRB |= PS2_CLOCK;
+    PORTB &= ~PS2_CLOCK;
+}
+
+/* ----------------------------------------------------------------------------
+ * ps2_release()
+ *
+ *  Let the keyboard send again after ps2_inhibit(), discarding the pin
+ *  change flagged by the inhibit itself.
+ *
+ *  param:  none
+ *  return: none
+ */
+void ps2_release(void)
+{
+    DDRB &= ~PS2_CLOCK;
+    PORTB |= PS2_CLOCK;
+
+    GIFR = (1 << PCIF1);
+    PCMSK1 |= PCMSK1_INIT;
+}
+
 /* ----------------------------------------------------------------------------
  * ps2_test_led()
  *
@@ -662,6 +895,108 @@ int kbd_code_set(int set)
     return temp_scan_code;
 }
 
+/* ----------------------------------------------------------------------------
+ * kbd_code_set_get()
+ *
+ *  The function reads back the keyboard's current scan code set.
+ *
+ *  param:  none
+ *  return: scan code set 1, 2 or 3, other keyboard response if error
+ */
+int kbd_code_set_get(void)
+{
+    int temp_scan_code;
+
+    ps2_send(PS2_HK_ALTCODE);
+    temp_scan_code = ps2_recv_x();
+
+    if ( temp_scan_code == PS2_KH_ACK )
+    {
+        ps2_send(0);
+        temp_scan_code = ps2_recv_x();
+
+        if ( temp_scan_code == PS2_KH_ACK )
+            temp_scan_code = ps2_recv_x();
+    }
+
+    return temp_scan_code;
+}
+
+/* ----------------------------------------------------------------------------
+ * kbd_set3_make_only()
+ *
+ *  Switch the keyboard to scan code set 3, check that it took the set,
+ *  make all keys make-only and then Shift and Ctrl make/break.
+ *  The key list after FC has no terminator of its own, so it is ended by
+ *  sending Enable (F4), which also restarts scanning.
+ *  If the keyboard rejects any step it is left for the caller to switch to set 1.
+ *
+ *  param:  none
+ *  return: PS2_KH_ACK no errors, other keyboard response if error
+ */
+int kbd_set3_make_only(void)
+{
+    static const uint8_t make_break[] = { 0x12, 0x59, 0x11, 0x58 };  // L/R Shift, L/R Ctrl
+    int     temp_scan_code;
+    uint8_t i;
+
+    temp_scan_code = kbd_code_set(3);
+    if ( temp_scan_code != PS2_KH_ACK )
+        return temp_scan_code;
+
+    // F0 00 reads back the current set
+    temp_scan_code = kbd_code_set_get();
+    if ( temp_scan_code != 3 )
+        return PS2_KH_RESEND;
+
+    ps2_send(PS2_HK_SET3);
+    temp_scan_code = ps2_recv_x();
+    if ( temp_scan_code != PS2_KH_ACK )
+        return temp_scan_code;
+
+    // FC is followed by the scan codes of the keys to set, each one acknowledged
+    ps2_send(PS2_HK_SET6);
+    temp_scan_code = ps2_recv_x();
+
+    for ( i = 0; i < sizeof(make_break) && temp_scan_code == PS2_KH_ACK; i++ )
+    {
+        ps2_send(make_break[i]);
+        temp_scan_code = ps2_recv_x();
+    }
+
+    if ( temp_scan_code != PS2_KH_ACK )
+        return temp_scan_code;
+
+    // end the key list with a command of its own
+    ps2_send(PS2_HK_ENABLE);
+    temp_scan_code = ps2_recv_x();
+
+    return temp_scan_code;
+}
+
+/* ----------------------------------------------------------------------------
+ * kbd_decode_timeout()
+ *
+ *  Drop a sequence prefix when no byte has followed it within KBD_SEQ_TIMEOUT,
+ *  so a byte lost on the line does not swallow a later key stroke.
+ *  Call with the CPU at full speed, Timer1 is read against the last PS2 clock edge.
+ *
+ *  param:  none
+ *  return: none
+ */
+void kbd_decode_timeout(void)
+{
+    uint16_t    idle;
+
+    // TCNT1 shares the TEMP register with the ISR
+    cli();
+    idle = TCNT1 - ps2_clk_last;
+    sei();
+
+    if ( ps2_rx_state == PS2_IDLE )
+        kbd_decode_expire(idle);
+}
+
 /* ----------------------------------------------------------------------------
  * kbd_typematic_set()
  *
@@ -694,6 +1029,85 @@ int kbd_typematic_set(uint8_t configuration)
     return temp_scan_code;
 }
 
+/* ----------------------------------------------------------------------------
+ * macro_play()
+ *
+ *  Type a macro from EEPROM. The macro is decoded as it is read,
+ *  a byte at a time, so it needs no RAM buffer (format in macro_dict.h).
+ *  Macros are stored back to back, macro n is found by skipping n of them.
+ *
+ *  param:  macro number, 0 for F1
+ *  return: none
+ */
+void macro_play(uint8_t macro)
+{
+    uint16_t    address = 0;
+    uint8_t     byte;
+
+    while ( macro > 0 && address < MACRO_EEPROM_SIZE )
+    {
+        byte = eeprom_read_byte((const uint8_t *)address++);
+        if ( byte == MACRO_LAST )
+            return;
+        if ( byte == MACRO_END )
+            macro--;
+    }
+
+    while ( address < MACRO_EEPROM_SIZE )
+    {
+        byte = eeprom_read_byte((const uint8_t *)address++);
+        if ( byte == MACRO_END || byte == MACRO_LAST )
+            break;
+
+        if ( byte & MACRO_WORD )
+            macro_word(byte & ~MACRO_WORD);
+        else
+            macro_key(byte | 0x80);
+    }
+}
+
+/* ----------------------------------------------------------------------------
+ * macro_word()
+ *
+ *  Type a dictionary word. The dictionary is one string in flash with
+ *  the words separated by zeros, word n is found by skipping n of them.
+ *
+ *  param:  word number
+ *  return: none
+ */
+void macro_word(uint8_t word)
+{
+    const char *p = macro_dict;
+    char        c;
+
+    while ( word > 0 && p < macro_dict + sizeof(macro_dict) )
+    {
+        if ( pgm_read_byte(p++) == 0 )
+            word--;
+    }
+
+    while ( p < macro_dict + sizeof(macro_dict) && (c = pgm_read_byte(p++)) != 0 )
+        macro_key((uint8_t)c | 0x80);
+}
+
+/* ----------------------------------------------------------------------------
+ * macro_key()
+ *
+ *  Type one macro key, and wait after a RETURN for the Apple to take the line in.
+ *  A long macro takes longer than the watch-dog time-out, so it is reset per key.
+ *
+ *  param:  Apple II key code
+ *  return: none
+ */
+void macro_key(uint8_t code)
+{
+    wdt_reset();
+    apple_kbd_put(code);
+
+    if ( code == APPLE_CR )
+        _delay_ms(MACRO_CR_DELAY);
+}
+
 /* ----------------------------------------------------------------------------
  * apple_kbd_write()
  *
@@ -707,7 +1121,7 @@ void apple_kbd_write(int code, uint8_t shift_ctrl_flags)
 {
     uint8_t byte;
 
-    byte = scan_code_xlate[shift_ctrl_flags][code];
+    byte = pgm_read_byte(&scan_code_xlate[shift_ctrl_flags][code]);
     if ( byte > 0x80 )
         PORTA = byte;
 
@@ -715,6 +1129,23 @@ void apple_kbd_write(int code, uint8_t shift_ctrl_flags)
     apple_kbd_stb();
 }
 
+/* ----------------------------------------------------------------------------
+ * apple_kbd_put()
+ *
+ *  Write an Apple II key code and pulse the strobe line.
+ *
+ *  param:  Apple II key code, high bit set
+ *  return: none
+ *
+ */
+void apple_kbd_put(uint8_t code)
+{
+    PORTA = code;
+
+    _delay_ms(8);
+    apple_kbd_stb();
+}
+
 /* ----------------------------------------------------------------------------
  * apple_kbd_stb()
  *
@@ -731,6 +1162,11 @@ void apple_kbd_stb(void)
     PORTA |= APPLE_STB;
 }
 
+/* ----------------------------------------------------------------------------
+ * Timer1 overflow only wakes the main loop from idle sleep.
+ */
+EMPTY_INTERRUPT(TIM1_OVF_vect);
+
 /* ----------------------------------------------------------------------------
  * This ISR will trigger when PB0 changes state.
  * PB0 is connected to the PS2 keyboard clock line, and PB1 to the data line.
@@ -738,14 +1174,85 @@ void apple_kbd_stb(void)
  * as well as track clock counts and input bits from PB1.
  * Once input byte is assembled is will be added to a circular buffer.
  *
+ * Every falling clock edge is time stamped with Timer1 to track the keyboard's
+ * clock rate and to recover from a frame that stops part way.
+ *
+ * The vector is a naked stub that samples port B and restores the 8MHz CPU clock
+ * before any register is saved, using only r24 (kept in a GPIO register) and
+ * instructions that leave SREG alone, then jumps to ps2_rx_isr(). While sleeping
+ * at 2MHz the wake-up, vector jump and the stub's first two instructions take
+ * about 5uSec, so the start bit is sampled well inside the 30uSec minimum clock low
+ * phase; the compiler's register saves in ps2_rx_isr() run at 8MHz after that.
+ * The start bit interval is counted at the slow rate, which does not matter as it
+ * is not used for the clock period estimate.
+ *
+ * The ISR must finish well within the shortest PS2 clock phase (30uSec).
+ * To keep its worst case short, port B is read once, all state is 8-bit,
+ * and data bits are shifted in from the top instead of shifting each bit
+ * by a variable count, which the AVR can only do in a loop.
+ *
  */
-ISR(PCINT1_vect)
+ISR(PCINT1_vect, ISR_NAKED)
 {
+    __asm__ __volatile__ (
+        "out    %[save], r24        \n\t"
+        "in     r24, %[pins]        \n\t"
+        "out    %[sample], r24      \n\t"
+        "ldi    r24, %[enable]      \n\t"
+        "out    %[clkpr], r24       \n\t"
+        "ldi    r24, %[fast]        \n\t"
+        "out    %[clkpr], r24       \n\t"
+        "in     r24, %[save]        \n\t"
+        "rjmp   ps2_rx_isr          \n\t"
+        :
+        : [save]   "I" (_SFR_IO_ADDR(GPIOR_SAVE)),
+          [pins]   "I" (_SFR_IO_ADDR(PINB)),
+          [sample] "I" (_SFR_IO_ADDR(GPIOR_PINS)),
+          [clkpr]  "I" (_SFR_IO_ADDR(CLKPR)),
+          [enable] "M" (_BV(CLKPCE)),
+          [fast]   "M" (CLKPR_FAST)
+    );
+}
+
+/* the body is entered only from the stub above, it saves what it uses and ends in reti.
+ * avr-gcc warns about a signal handler without a vector name, which is intended here.
+ */
+#pragma GCC diagnostic ignored "-Wmisspelled-isr"
+void ps2_rx_isr(void) __attribute__ ((signal, used));
+
+void ps2_rx_isr(void)
+{
+    uint8_t         ps2_pins;
     uint8_t         ps2_data_bit;
+    uint16_t        now, interval, period;
+
+    ps2_pins = GPIOR_PINS;
 
-    if ( (PINB & PS2_CLOCK) == 0 )
+    if ( (ps2_pins & PS2_CLOCK) == 0 )
     {
-        ps2_data_bit = (PINB & PS2_DATA) >> 1;
+        ps2_data_bit = (ps2_pins & PS2_DATA) >> 1;
+
+        /* time stamp the falling edge.
+         * inside a frame, a plausible interval updates the clock period estimate
+         * (1/8 weight). an interval of more than PS2_FRAME_PERIODS clock periods
+         * (at most the 2mSec of the PS2 spec) means edges were lost, or this is the
+         * start bit of the frame after one that signaled an error; drop that frame
+         * and take this edge as a new start bit. a frame following an error frame
+         * closely is then still received.
+         */
+        now = TCNT1;
+        interval = now - ps2_clk_last;
+        ps2_clk_last = now;
+
+        if ( ps2_rx_state != PS2_IDLE )
+        {
+            period = ps2_clk_period;
+            if ( interval >= PS2_CLK_PERIOD_MIN && interval <= PS2_CLK_PERIOD_MAX )
+                ps2_clk_period = period += ((int16_t)(interval - period)) >> 3;
+
+            if ( interval > ps2_frame_timeout(period) )
+                ps2_rx_state = PS2_IDLE;
+        }
 
         switch ( ps2_rx_state )
         {
@@ -772,12 +1279,14 @@ ISR(PCINT1_vect)
                     ps2_rx_state = PS2_RX_ERR_START;
                 break;
 
-            /* accumulate eight bits of data LSB first
+            /* accumulate eight bits of data LSB first,
+             * after eight shifts the first bit is in b0
              */
             case PS2_DATA_BITS:
-                ps2_rx_parity += ps2_data_bit;
-                ps2_data_bit = ps2_data_bit << ps2_rx_bit_count;
-                ps2_rx_data_byte += ps2_data_bit;
+                ps2_rx_parity ^= ps2_data_bit;
+                ps2_rx_data_byte >>= 1;
+                if ( ps2_data_bit )
+                    ps2_rx_data_byte |= 0x80;
                 ps2_rx_bit_count++;
                 if ( ps2_rx_bit_count == 8 )
                     ps2_rx_state = PS2_PARITY;
@@ -786,7 +1295,7 @@ ISR(PCINT1_vect)
             /* evaluate the parity and signal error if it is wrong
              */
             case PS2_PARITY:
-                if ( ((ps2_rx_parity + ps2_data_bit) & 1) )
+                if ( ps2_rx_parity ^ ps2_data_bit )
                     ps2_rx_state = PS2_STOP;
                 else
                     ps2_rx_state = PS2_RX_ERR_PARITY;
@@ -0,0 +1,298 @@
+/*
+ * upload.c
+ *
+ *  Host side of the ps2apple serial bootloader (see bootloader.c).
+ *
+ *  usage: upload [-r] -p port firmware.bin
+ *         upload -o patched.bin firmware.bin
+ *
+ *  -p  serial port wired to PB2, e.g. /dev/ttyUSB0
+ *  -r  reset the board by pulsing DTR (wired to the AVR reset pin);
+ *      without it, reset or power up the board when asked
+ *  -o  only write the patched image, for the first ISP install together
+ *      with bootloader.hex
+ *
+ *  firmware.bin is the raw application image, e.g. from
+ *  "avr-objcopy -O binary ps2apple.elf ps2apple.bin". Its reset vector is
+ *  moved to the word below the bootloader and replaced by a jump to the
+ *  bootloader. The uploader holds the line low (serial break) through
+ *  reset to enter the bootloader, reads the CRC of every flash page and
+ *  sends only the pages that differ.
+ *
+ *  At 57600 baud a page should take about 12 msec to send and 9 msec to
+ *  erase and write, so a full reflash of 112 pages would be about 2.4 sec.
+ *  These are estimates; the bootloader has not been timed on hardware.
+ *
+ *  build: cc -O2 -o upload upload.c
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/select.h>
+#include <sys/time.h>
+
+#define PAGE_SIZE       64
+#define BOOT_START      0x1c00
+#define APP_PAGES       (BOOT_START / PAGE_SIZE)
+#define APP_JUMP        (BOOT_START - 2)
+#define RJMP(from, to)  (0xc000 | (((to) / 2 - (from) / 2 - 1) & 0x0fff))
+
+#define TIMEOUT_MS      500
+
+static int port = -1;
+
+/* same as _crc_ccitt_update() in avr-libc <util/crc16.h> */
+static uint16_t crc_ccitt_update(uint16_t crc, uint8_t data)
+{
+    data ^= crc & 0xff;
+    data ^= data << 4;
+
+    return ((((uint16_t)data << 8) | (crc >> 8)) ^ (uint8_t)(data >> 4)
+            ^ ((uint16_t)data << 3));
+}
+
+static uint16_t page_crc(const unsigned char *page)
+{
+    uint16_t crc = 0xffff;
+    int      i;
+
+    for (i = 0; i < PAGE_SIZE; i++)
+        crc = crc_ccitt_update(crc, page[i]);
+    return crc;
+}
+
+/*
+ * patch()
+ *
+ *  Point the reset vector at the bootloader and put the application's
+ *  own reset jump below it. Returns -1 if the image does not fit or does
+ *  not start with an rjmp.
+ */
+static int patch(unsigned char *image, size_t len)
+{
+    unsigned int vector, target;
+
+    if (len > APP_JUMP) {
+        fprintf(stderr, "upload: image is %zu bytes, the limit is %d\n", len, APP_JUMP);
+        return -1;
+    }
+
+    vector = image[0] | image[1] << 8;
+    if ((vector & 0xf000) != 0xc000) {
+        fprintf(stderr, "upload: image does not start with an rjmp\n");
+        return -1;
+    }
+    target = ((vector + 1) & 0x0fff) * 2;   // rjmp wraps around the 8K flash
+
+    vector = RJMP(0, BOOT_START);
+    image[0] = vector & 0xff;
+    image[1] = vector >> 8;
+
+    vector = RJMP(APP_JUMP, target);
+    image[APP_JUMP] = vector & 0xff;
+    image[APP_JUMP + 1] = vector >> 8;
+
+    return 0;
+}
+
+static int port_open(const char *name)
+{
+    struct termios tio;
+
+    if ((port = open(name, O_RDWR | O_NOCTTY)) < 0 || tcgetattr(port, &tio) < 0) {
+        perror(name);
+        return -1;
+    }
+
+    cfmakeraw(&tio);
+    cfsetispeed(&tio, B57600);
+    cfsetospeed(&tio, B57600);
+    tio.c_cflag |= CLOCAL | CREAD;
+    tio.c_cc[VMIN] = 0;
+    tio.c_cc[VTIME] = 0;
+    if (tcsetattr(port, TCSANOW, &tio) < 0) {
+        perror(name);
+        return -1;
+    }
+
+    return 0;
+}
+
+static int port_read(unsigned char *buf, size_t len)
+{
+    struct timeval tv;
+    fd_set         fds;
+    ssize_t        got;
+
+    while (len > 0) {
+        FD_ZERO(&fds);
+        FD_SET(port, &fds);
+        tv.tv_sec = 0;
+        tv.tv_usec = TIMEOUT_MS * 1000;
+        if (select(port + 1, &fds, NULL, NULL, &tv) <= 0)
+            return -1;
+        if ((got = read(port, buf, len)) <= 0)
+            return -1;
+        buf += got;
+        len -= got;
+    }
+
+    return 0;
+}
+
+/*
+ * command()
+ *
+ *  Send a command and read its reply. The single wire echoes everything
+ *  sent, so the echo is read back and checked first.
+ */
+static int command(const unsigned char *out, size_t out_len, unsigned char *in, size_t in_len)
+{
+    unsigned char echo[PAGE_SIZE + 4];
+
+    if (write(port, out, out_len) != (ssize_t)out_len ||
+        port_read(echo, out_len) < 0 || memcmp(echo, out, out_len) != 0 ||
+        port_read(in, in_len) < 0) {
+        fprintf(stderr, "upload: no answer from the bootloader\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * enter()
+ *
+ *  Hold a break through reset so the bootloader stays, then release it.
+ */
+static int enter(int reset)
+{
+    int dtr = TIOCM_DTR;
+
+    ioctl(port, TIOCSBRK);
+
+    if (reset) {
+        ioctl(port, TIOCMBIS, &dtr);
+        usleep(20000);
+        ioctl(port, TIOCMBIC, &dtr);
+    }
+    else {
+        fprintf(stderr, "upload: reset the board, then press return\n");
+        getchar();
+    }
+
+    usleep(50000);
+    ioctl(port, TIOCCBRK);
+    usleep(10000);
+    tcflush(port, TCIOFLUSH);
+
+    return 0;
+}
+
+static int upload(unsigned char *image)
+{
+    unsigned char  cmd[PAGE_SIZE + 4], reply[3];
+    uint16_t       crc;
+    struct timeval start, end;
+    int            page, written = 0;
+
+    gettimeofday(&start, NULL);
+
+    cmd[0] = 'I';
+    if (command(cmd, 1, reply, 3) < 0)
+        return -1;
+    if (reply[0] != 'B' || reply[1] != PAGE_SIZE || reply[2] != APP_PAGES) {
+        fprintf(stderr, "upload: unexpected bootloader id %02x %02x %02x\n",
+                reply[0], reply[1], reply[2]);
+        return -1;
+    }
+
+    for (page = 0; page < APP_PAGES; page++) {
+        crc = page_crc(image + page * PAGE_SIZE);
+
+        cmd[0] = 'C';
+        cmd[1] = (unsigned char)page;
+        if (command(cmd, 2, reply, 2) < 0)
+            return -1;
+        if ((reply[0] | reply[1] << 8) == crc)
+            continue;
+
+        cmd[0] = 'W';
+        cmd[1] = (unsigned char)page;
+        memcpy(cmd + 2, image + page * PAGE_SIZE, PAGE_SIZE);
+        cmd[PAGE_SIZE + 2] = crc & 0xff;
+        cmd[PAGE_SIZE + 3] = crc >> 8;
+        if (command(cmd, PAGE_SIZE + 4, reply, 1) < 0)
+            return -1;
+        if (reply[0] != 'K') {
+            fprintf(stderr, "upload: page %d rejected\n", page);
+            return -1;
+        }
+        written++;
+    }
+
+    cmd[0] = 'X';
+    if (command(cmd, 1, reply, 1) < 0)
+        return -1;
+
+    gettimeofday(&end, NULL);
+    fprintf(stderr, "upload: %d of %d pages written in %.2f sec\n", written, APP_PAGES,
+            (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6);
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned char  image[BOOT_START];
+    const char    *port_name = NULL, *out_name = NULL;
+    FILE          *in, *out;
+    size_t         len;
+    int            c, reset = 0, status = 0;
+
+    while ((c = getopt(argc, argv, "p:ro:")) != -1) {
+        switch (c) {
+            case 'p': port_name = optarg; break;
+            case 'r': reset = 1; break;
+            case 'o': out_name = optarg; break;
+            default:  status = 2; break;
+        }
+    }
+
+    if (status || optind != argc - 1 || (port_name == NULL) == (out_name == NULL)) {
+        fprintf(stderr, "usage: upload [-r] -p port firmware.bin\n"
+                        "       upload -o patched.bin firmware.bin\n");
+        return 2;
+    }
+
+    if ((in = fopen(argv[optind], "rb")) == NULL) {
+        perror(argv[optind]);
+        return 1;
+    }
+    memset(image, 0xff, sizeof(image));
+    len = fread(image, 1, sizeof(image), in);
+    fclose(in);
+
+    if (len < 2 || patch(image, len) < 0)
+        return 1;
+
+    if (out_name != NULL) {
+        if ((out = fopen(out_name, "wb")) == NULL ||
+            fwrite(image, 1, BOOT_START, out) != BOOT_START || fclose(out) != 0) {
+            perror(out_name);
+            return 1;
+        }
+        return 0;
+    }
+
+    if (port_open(port_name) < 0 || enter(reset) < 0 || upload(image) < 0)
+        return 1;
+
+    return 0;
+}
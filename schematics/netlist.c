@@ -0,0 +1,810 @@
+/*
+ * netlist.c
+ *
+ *  Extract connectivity from KiCad 6 schematics.
+ *
+ *  usage: netlist [-p ref] schematic.kicad_sch ...
+ *
+ *  -p  instead of the netlist, print the net on each AVR port pin
+ *      (PA0..PD7) of symbol ref, to check firmware pin use against
+ *
+ *  The file is mapped read only and tokenized in one pass into a tree of
+ *  nodes that point into the mapping, so no atom or string is copied.
+ *  Pins of placed symbols (library pin position through the symbol's
+ *  rotation and mirror), wire ends, junctions and labels become points,
+ *  which are joined when they share coordinates or a point lies on a
+ *  wire. Labels and power symbols also join by name; global labels and
+ *  power symbols across all the given sheets, local labels per sheet.
+ *  The points are sorted by position, so each wire only tests the points
+ *  inside its extent, and after joining one pass over the points finds the
+ *  name and the pins of every net.
+ *
+ *  Buses only carry nets by label name. A bus with unlabeled entries, as
+ *  in rom.kicad_sch, does not connect anything.
+ *
+ *  build: cc -O2 -o netlist netlist.c -lm
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* ----------------------------------------------------------------------------
+ * S-expression tree
+ */
+typedef struct
+{
+    const char *s;              // atom text, quotes removed, not terminated
+    uint32_t    len;
+    int32_t     child;          // first child of a list, -1 for an atom
+    int32_t     next;           // next sibling
+} node_t;
+
+typedef struct
+{
+    const char *s;
+    uint32_t    len;
+} str_t;
+
+static node_t  *nodes;
+static size_t   node_count, node_size;
+
+static int32_t new_node(const char *s, uint32_t len, int list)
+{
+    node_t *tmp;
+
+    if (node_count == node_size) {
+        node_size = node_size ? node_size * 2 : 65536;
+        tmp = realloc(nodes, node_size * sizeof(*nodes));
+        if (tmp == NULL)
+            return -1;
+        nodes = tmp;
+    }
+    nodes[node_count].s = s;
+    nodes[node_count].len = len;
+    nodes[node_count].child = list ? -2 : -1;   // -2 empty list
+    nodes[node_count].next = -1;
+
+    return (int32_t)node_count++;
+}
+
+/*
+ * parse()
+ *
+ *  Tokenize a buffer into the node tree and return the root list, -1 on
+ *  a syntax error or out of memory.
+ */
+#define MAX_DEPTH       64
+
+static int32_t parse(const char *p, const char *end)
+{
+    int32_t     open[MAX_DEPTH], last[MAX_DEPTH];
+    int32_t     n, root = -1;
+    int         depth = -1;
+    const char *s;
+
+    while (p < end) {
+        if (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') {
+            p++;
+            continue;
+        }
+
+        if (*p == ')') {
+            if (depth < 0)
+                return -1;
+            depth--;
+            p++;
+            continue;
+        }
+
+        if (*p == '(') {
+            n = new_node(p, 0, 1);
+            p++;
+        }
+        else if (*p == '"') {
+            for (s = ++p; p < end && *p != '"'; p++)
+                if (*p == '\\')
+                    p++;
+            if (p >= end)
+                return -1;
+            n = new_node(s, (uint32_t)(p - s), 0);
+            p++;
+        }
+        else {
+            for (s = p; p < end && *p != ' ' && *p != '\t' && *p != '\r' &&
+                        *p != '\n' && *p != '(' && *p != ')'; p++)
+                ;
+            n = new_node(s, (uint32_t)(p - s), 0);
+        }
+        if (n < 0)
+            return -1;
+
+        // link into the enclosing list
+        if (depth >= 0) {
+            if (last[depth] < 0)
+                nodes[open[depth]].child = n;
+            else
+                nodes[last[depth]].next = n;
+            last[depth] = n;
+        }
+        else if (root < 0)
+            root = n;
+
+        if (nodes[n].child == -2) {
+            if (++depth == MAX_DEPTH)
+                return -1;
+            open[depth] = n;
+            last[depth] = -1;
+        }
+    }
+
+    return depth < 0 ? root : -1;
+}
+
+static int is_list(int32_t n)
+{
+    return n >= 0 && nodes[n].child != -1;
+}
+
+static int eq(str_t a, const char *b)
+{
+    return a.len == strlen(b) && memcmp(a.s, b, a.len) == 0;
+}
+
+static int same(str_t a, str_t b)
+{
+    return a.len == b.len && memcmp(a.s, b.s, a.len) == 0;
+}
+
+/* i-th element of a list, element 0 is the head keyword */
+static int32_t elem(int32_t n, int i)
+{
+    int32_t c = is_list(n) && nodes[n].child >= 0 ? nodes[n].child : -1;
+
+    for (; c >= 0 && i > 0; i--)
+        c = nodes[c].next;
+    return c;
+}
+
+static str_t text(int32_t n)
+{
+    str_t t = { "", 0 };
+
+    if (n >= 0 && !is_list(n)) {
+        t.s = nodes[n].s;
+        t.len = nodes[n].len;
+    }
+    return t;
+}
+
+static int head_is(int32_t n, const char *name)
+{
+    return is_list(n) && eq(text(elem(n, 0)), name);
+}
+
+/* first child list of n with the given head keyword */
+static int32_t find(int32_t n, const char *name)
+{
+    int32_t c;
+
+    for (c = elem(n, 1); c >= 0; c = nodes[c].next)
+        if (head_is(c, name))
+            return c;
+    return -1;
+}
+
+/* atoms end at white space or a parenthesis, so strtod() stops there */
+static double number(int32_t n)
+{
+    return n >= 0 && !is_list(n) ? strtod(nodes[n].s, NULL) : 0.0;
+}
+
+/* value of (property "key" "value" ...) */
+static str_t property(int32_t n, const char *key)
+{
+    str_t   none = { "", 0 };
+    int32_t c;
+
+    for (c = elem(n, 1); c >= 0; c = nodes[c].next)
+        if (head_is(c, "property") && eq(text(elem(c, 1)), key))
+            return text(elem(c, 2));
+    return none;
+}
+
+/* ----------------------------------------------------------------------------
+ * Schematic objects
+ */
+
+// coordinates are kept in units of 0.1um so points compare exactly
+#define COORD(v)        ((int64_t)llround((v) * 10000.0))
+
+typedef enum
+{
+    PT_PIN,
+    PT_WIRE,
+    PT_JUNCTION,
+    PT_LABEL,
+    PT_GLOBAL,                  // global label or power symbol
+} point_type_t;
+
+typedef struct
+{
+    point_type_t type;
+    int64_t      x, y;
+    int          sheet;
+    str_t        name;          // label or power net name
+    str_t        ref;           // pin: symbol reference
+    str_t        num;           // pin: number
+    str_t        pin;           // pin: name
+    int          parent;        // union-find
+} point_t;
+
+typedef struct
+{
+    int64_t x1, y1, x2, y2;
+    int     point;              // point of the first end
+    int     sheet;
+} wire_t;
+
+typedef struct
+{
+    str_t   name;
+    int32_t node;
+    int     power;
+} lib_t;
+
+typedef struct
+{
+    int     label;              // naming label or power point, -1 if none
+    int     first_pin;          // pins in point order, linked by pin_next
+    int     pins;
+} net_t;
+
+static point_t *points;
+static size_t   point_count, point_size;
+static net_t   *nets;           // indexed by the root point of a net
+static int     *pin_next;
+static wire_t  *wires;
+static size_t   wire_count, wire_size;
+static int      bus_count;
+
+static int add_point(point_type_t type, int64_t x, int64_t y, int sheet)
+{
+    point_t *tmp;
+
+    if (point_count == point_size) {
+        point_size = point_size ? point_size * 2 : 1024;
+        tmp = realloc(points, point_size * sizeof(*points));
+        if (tmp == NULL)
+            return -1;
+        points = tmp;
+    }
+    memset(&points[point_count], 0, sizeof(*points));
+    points[point_count].type = type;
+    points[point_count].x = x;
+    points[point_count].y = y;
+    points[point_count].sheet = sheet;
+    points[point_count].parent = (int)point_count;
+
+    return (int)point_count++;
+}
+
+static int add_wire(int32_t n, int sheet)
+{
+    wire_t  *tmp, *w;
+    int32_t  pts = find(n, "pts");
+    int32_t  a = elem(pts, 1), b = elem(pts, 2);
+
+    if (!head_is(a, "xy") || !head_is(b, "xy"))
+        return 0;
+
+    if (wire_count == wire_size) {
+        wire_size = wire_size ? wire_size * 2 : 256;
+        tmp = realloc(wires, wire_size * sizeof(*wires));
+        if (tmp == NULL)
+            return -1;
+        wires = tmp;
+    }
+    w = &wires[wire_count];
+    w->x1 = COORD(number(elem(a, 1)));
+    w->y1 = COORD(number(elem(a, 2)));
+    w->x2 = COORD(number(elem(b, 1)));
+    w->y2 = COORD(number(elem(b, 2)));
+    w->sheet = sheet;
+    if ((w->point = add_point(PT_WIRE, w->x1, w->y1, sheet)) < 0 ||
+        add_point(PT_WIRE, w->x2, w->y2, sheet) < 0)
+        return -1;
+    wire_count++;
+
+    return 0;
+}
+
+/*
+ * add_symbol()
+ *
+ *  Add the pins of a placed symbol. Library pins are in y-up coordinates;
+ *  the symbol is rotated counterclockwise on the y-down sheet, then
+ *  mirrored. Pins of other units and of the De Morgan body style are
+ *  skipped.
+ */
+static int add_symbol(int32_t n, const lib_t *libs, int lib_count, int sheet)
+{
+    const lib_t *lib = NULL;
+    str_t        lib_id = text(elem(find(n, "lib_id"), 1));
+    str_t        ref = property(n, "Reference");
+    str_t        sub;
+    int32_t      at = find(n, "at"), mirror = find(n, "mirror");
+    int32_t      unit_node = find(n, "unit");
+    int32_t      s, p, pat;
+    int64_t      x, y, px, py, t;
+    int          i, angle, unit, sub_unit, sub_style, k;
+
+    for (i = 0; i < lib_count; i++)
+        if (same(libs[i].name, lib_id))
+            lib = &libs[i];
+    if (lib == NULL) {
+        fprintf(stderr, "netlist: %.*s: no library symbol %.*s\n",
+                (int)ref.len, ref.s, (int)lib_id.len, lib_id.s);
+        return 0;
+    }
+
+    x = COORD(number(elem(at, 1)));
+    y = COORD(number(elem(at, 2)));
+    angle = ((int)number(elem(at, 3)) % 360 + 360) % 360;
+    unit = unit_node >= 0 ? (int)number(elem(unit_node, 1)) : 1;
+
+    for (s = elem(lib->node, 2); s >= 0; s = nodes[s].next) {
+        if (!head_is(s, "symbol"))
+            continue;
+
+        // unit symbols are named "<name>_<unit>_<style>", unit 0 is common
+        sub = text(elem(s, 1));
+        for (k = (int)sub.len - 1; k > 0 && sub.s[k] != '_'; k--)
+            ;
+        sub_style = atoi(sub.s + k + 1);
+        for (k--; k > 0 && sub.s[k] != '_'; k--)
+            ;
+        sub_unit = atoi(sub.s + k + 1);
+        if ((sub_unit != 0 && sub_unit != unit) || sub_style > 1)
+            continue;
+
+        for (p = elem(s, 2); p >= 0; p = nodes[p].next) {
+            if (!head_is(p, "pin"))
+                continue;
+
+            pat = find(p, "at");
+            px = COORD(number(elem(pat, 1)));
+            py = -COORD(number(elem(pat, 2)));
+            for (i = 0; i < angle / 90; i++) {
+                t = px;
+                px = py;
+                py = -t;
+            }
+            if (mirror >= 0 && eq(text(elem(mirror, 1)), "x"))
+                py = -py;
+            if (mirror >= 0 && eq(text(elem(mirror, 1)), "y"))
+                px = -px;
+
+            if ((i = add_point(lib->power ? PT_GLOBAL : PT_PIN, x + px, y + py, sheet)) < 0)
+                return -1;
+            points[i].ref = ref;
+            points[i].num = text(elem(find(p, "number"), 1));
+            points[i].pin = text(elem(find(p, "name"), 1));
+            if (lib->power)
+                points[i].name = property(n, "Value");
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * load()
+ *
+ *  Map and parse one schematic and add its objects as sheet number sheet.
+ *  The mapping stays in place as the nodes point into it.
+ */
+static int load(const char *name, int sheet)
+{
+    struct stat st;
+    lib_t      *libs = NULL;
+    const char *map;
+    int32_t     root, n, l, at;
+    int         fd, i, lib_count = 0, result = 0;
+
+    if ((fd = open(name, O_RDONLY)) < 0 || fstat(fd, &st) < 0) {
+        perror(name);
+        return -1;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (st.st_size == 0 || map == MAP_FAILED) {
+        fprintf(stderr, "%s: cannot map file\n", name);
+        return -1;
+    }
+
+    if ((root = parse(map, map + st.st_size)) < 0 || !head_is(root, "kicad_sch")) {
+        fprintf(stderr, "%s: not a KiCad schematic\n", name);
+        return -1;
+    }
+
+    l = find(root, "lib_symbols");
+    for (n = elem(l, 1); n >= 0; n = nodes[n].next)
+        lib_count++;
+    if (lib_count && (libs = calloc(lib_count, sizeof(*libs))) == NULL)
+        return -1;
+    for (i = 0, n = elem(l, 1); n >= 0; n = nodes[n].next, i++) {
+        libs[i].name = text(elem(n, 1));
+        libs[i].node = n;
+        libs[i].power = find(n, "power") >= 0;
+    }
+
+    for (n = elem(root, 1); n >= 0 && result == 0; n = nodes[n].next) {
+        at = find(n, "at");
+
+        if (head_is(n, "wire"))
+            result = add_wire(n, sheet);
+        else if (head_is(n, "symbol"))
+            result = add_symbol(n, libs, lib_count, sheet);
+        else if (head_is(n, "junction"))
+            result = add_point(PT_JUNCTION, COORD(number(elem(at, 1))),
+                               COORD(number(elem(at, 2))), sheet) < 0 ? -1 : 0;
+        else if (head_is(n, "label") || head_is(n, "global_label") ||
+                 head_is(n, "hierarchical_label")) {
+            i = add_point(head_is(n, "label") ? PT_LABEL : PT_GLOBAL,
+                          COORD(number(elem(at, 1))), COORD(number(elem(at, 2))), sheet);
+            if (i < 0)
+                result = -1;
+            else
+                points[i].name = text(elem(n, 1));
+        }
+        else if (head_is(n, "bus"))
+            bus_count++;
+    }
+
+    free(libs);
+    return result;
+}
+
+/* ----------------------------------------------------------------------------
+ * Connectivity
+ */
+static int root_of(int i)
+{
+    while (points[i].parent != i)
+        i = points[i].parent = points[points[i].parent].parent;
+    return i;
+}
+
+static void join(int a, int b)
+{
+    a = root_of(a);
+    b = root_of(b);
+    if (a != b)
+        points[a > b ? a : b].parent = a < b ? a : b;
+}
+
+static int on_wire(const point_t *p, const wire_t *w)
+{
+    if (p->sheet != w->sheet)
+        return 0;
+    if ((p->x - w->x1) * (w->y2 - w->y1) != (p->y - w->y1) * (w->x2 - w->x1))
+        return 0;
+    return p->x >= (w->x1 < w->x2 ? w->x1 : w->x2) && p->x <= (w->x1 > w->x2 ? w->x1 : w->x2) &&
+           p->y >= (w->y1 < w->y2 ? w->y1 : w->y2) && p->y <= (w->y1 > w->y2 ? w->y1 : w->y2);
+}
+
+static int compare_position(const void *a, const void *b)
+{
+    const point_t *x = &points[*(const int *)a], *y = &points[*(const int *)b];
+
+    if (x->sheet != y->sheet)
+        return x->sheet - y->sheet;
+    if (x->x != y->x)
+        return x->x < y->x ? -1 : 1;
+    if (x->y != y->y)
+        return x->y < y->y ? -1 : 1;
+    return 0;
+}
+
+static int compare_position_y(const void *a, const void *b)
+{
+    const point_t *x = &points[*(const int *)a], *y = &points[*(const int *)b];
+
+    if (x->sheet != y->sheet)
+        return x->sheet - y->sheet;
+    if (x->y != y->y)
+        return x->y < y->y ? -1 : 1;
+    if (x->x != y->x)
+        return x->x < y->x ? -1 : 1;
+    return 0;
+}
+
+/*
+ * join_wire()
+ *
+ *  Join the points lying on a wire. The points are sorted by sheet and x
+ *  (by_x) and by sheet and y (by_y); the wire is searched along its longer
+ *  extent, so a vertical wire only visits points in its column and a
+ *  horizontal one only those in its row.
+ */
+static void join_wire(const wire_t *w, const int *by_x, const int *by_y)
+{
+    const int     *order;
+    const point_t *p;
+    int64_t        lo, hi, v;
+    size_t         first = 0, last = point_count, mid, i;
+    int            vertical;
+
+    vertical = llabs(w->x2 - w->x1) <= llabs(w->y2 - w->y1);
+    order = vertical ? by_x : by_y;
+    lo = vertical ? (w->x1 < w->x2 ? w->x1 : w->x2) : (w->y1 < w->y2 ? w->y1 : w->y2);
+    hi = vertical ? (w->x1 > w->x2 ? w->x1 : w->x2) : (w->y1 > w->y2 ? w->y1 : w->y2);
+
+    // first point at or after (sheet, lo)
+    while (first < last) {
+        mid = (first + last) / 2;
+        p = &points[order[mid]];
+        v = vertical ? p->x : p->y;
+        if (p->sheet < w->sheet || (p->sheet == w->sheet && v < lo))
+            first = mid + 1;
+        else
+            last = mid;
+    }
+
+    for (i = first; i < point_count; i++) {
+        p = &points[order[i]];
+        if (p->sheet != w->sheet || (vertical ? p->x : p->y) > hi)
+            break;
+        if (on_wire(p, w))
+            join(order[i], w->point);
+    }
+}
+
+static int compare_name(const void *a, const void *b)
+{
+    const point_t *x = &points[*(const int *)a], *y = &points[*(const int *)b];
+    int            c;
+
+    if (x->type != y->type)
+        return x->type - y->type;
+    if (x->type == PT_LABEL && x->sheet != y->sheet)
+        return x->sheet - y->sheet;
+    c = memcmp(x->name.s, y->name.s, x->name.len < y->name.len ? x->name.len : y->name.len);
+    if (c == 0 && x->name.len != y->name.len)
+        c = x->name.len < y->name.len ? -1 : 1;
+    return c;
+}
+
+/*
+ * build_nets()
+ *
+ *  Settle every point on its root and collect the naming label and the
+ *  pins of each net, so later lookups do not walk all the points.
+ */
+static int build_nets(void)
+{
+    const point_t *p, *label;
+    size_t         i;
+    int            net;
+
+    nets = malloc(point_count * sizeof(*nets));
+    pin_next = malloc(point_count * sizeof(*pin_next));
+    if (nets == NULL || pin_next == NULL)
+        return -1;
+
+    for (i = 0; i < point_count; i++) {
+        nets[i].label = -1;
+        nets[i].first_pin = -1;
+        nets[i].pins = 0;
+        points[i].parent = root_of((int)i);
+    }
+
+    // backwards, so pins are linked in point order and the first global
+    // label, else the first local label, names the net
+    for (i = point_count; i-- > 0; ) {
+        p = &points[i];
+        net = p->parent;
+        label = nets[net].label >= 0 ? &points[nets[net].label] : NULL;
+
+        if (p->type == PT_GLOBAL)
+            nets[net].label = (int)i;
+        else if (p->type == PT_LABEL && (label == NULL || label->type == PT_LABEL))
+            nets[net].label = (int)i;
+        else if (p->type == PT_PIN) {
+            pin_next[i] = nets[net].first_pin;
+            nets[net].first_pin = (int)i;
+            nets[net].pins++;
+        }
+    }
+
+    return 0;
+}
+
+static int connect(void)
+{
+    int    *order, *by_y;
+    size_t  i, k;
+
+    order = malloc(point_count * sizeof(*order));
+    by_y = malloc(point_count * sizeof(*by_y));
+    if (order == NULL || by_y == NULL) {
+        free(order);
+        free(by_y);
+        return -1;
+    }
+
+    // wire ends
+    for (i = 0; i < wire_count; i++)
+        join(wires[i].point, wires[i].point + 1);
+
+    // coincident points
+    for (i = 0; i < point_count; i++)
+        order[i] = (int)i;
+    qsort(order, point_count, sizeof(*order), compare_position);
+    for (i = 1; i < point_count; i++)
+        if (compare_position(&order[i - 1], &order[i]) == 0)
+            join(order[i - 1], order[i]);
+
+    // points on the middle of a wire
+    for (i = 0; i < point_count; i++)
+        by_y[i] = (int)i;
+    qsort(by_y, point_count, sizeof(*by_y), compare_position_y);
+    for (i = 0; i < wire_count; i++)
+        join_wire(&wires[i], order, by_y);
+    free(by_y);
+
+    // labels and power symbols of the same name
+    for (i = k = 0; i < point_count; i++)
+        if (points[i].type == PT_LABEL || points[i].type == PT_GLOBAL)
+            order[k++] = (int)i;
+    qsort(order, k, sizeof(*order), compare_name);
+    for (i = 1; i < k; i++)
+        if (compare_name(&order[i - 1], &order[i]) == 0)
+            join(order[i - 1], order[i]);
+
+    free(order);
+    return build_nets();
+}
+
+/*
+ * net_name()
+ *
+ *  Name a net by its global label or power symbol, else by its local
+ *  label, else by its first pin as KiCad does. Returns 2 for a labeled
+ *  net, 1 for a net named after a pin and 0 for a net without pins.
+ */
+static int net_name(int net, char *name, size_t size)
+{
+    const point_t *label, *pin;
+
+    if (nets[net].label >= 0) {
+        label = &points[nets[net].label];
+        snprintf(name, size, "%.*s", (int)label->name.len, label->name.s);
+        return 2;
+    }
+    else if (nets[net].first_pin >= 0) {
+        pin = &points[nets[net].first_pin];
+        snprintf(name, size, "Net-(%.*s-Pad%.*s)", (int)pin->ref.len, pin->ref.s,
+                 (int)pin->num.len, pin->num.s);
+    }
+    else
+        return 0;
+
+    return 1;
+}
+
+static void print_netlist(void)
+{
+    char   name[256];
+    size_t i;
+    int    j;
+
+    for (i = 0; i < point_count; i++) {
+        if (points[i].parent != (int)i || nets[i].pins == 0 ||
+            !net_name((int)i, name, sizeof(name)))
+            continue;
+
+        printf("net %s%s\n", name, nets[i].pins == 1 ? " (one pin)" : "");
+        for (j = nets[i].first_pin; j >= 0; j = pin_next[j])
+            printf("    %-6.*s %-4.*s %.*s\n",
+                   (int)points[j].ref.len, points[j].ref.s,
+                   (int)points[j].num.len, points[j].num.s,
+                   (int)points[j].pin.len, points[j].pin.s);
+    }
+
+    if (bus_count)
+        fprintf(stderr, "netlist: %d bus segments, connected by label name only\n", bus_count);
+}
+
+/*
+ * print_pins()
+ *
+ *  Print the net on each port pin of one symbol and a mask of the
+ *  connected pins per port, to hold against the firmware's port setup.
+ *  Pin names such as "XTAL1/PB0" are searched for a "Pxn" part.
+ */
+static int print_pins(const char *ref)
+{
+    char           name[256];
+    unsigned       used[4] = { 0, 0, 0, 0 };
+    const point_t *p;
+    const char    *s;
+    size_t         i;
+    int            port, bit, net, connected, found = 0;
+
+    printf("%s port pins\n", ref);
+
+    for (i = 0; i < point_count; i++) {
+        p = &points[i];
+        if (p->type != PT_PIN || !eq(p->ref, ref))
+            continue;
+        found = 1;
+
+        for (port = -1, s = p->pin.s; s + 3 <= p->pin.s + p->pin.len; s++) {
+            if (s[0] == 'P' && s[1] >= 'A' && s[1] <= 'D' && s[2] >= '0' && s[2] <= '7' &&
+                (s == p->pin.s || s[-1] == '/') && (s + 3 == p->pin.s + p->pin.len || s[3] == '/')) {
+                port = s[1] - 'A';
+                bit = s[2] - '0';
+                break;
+            }
+        }
+        if (port < 0)
+            continue;
+
+        net = p->parent;
+        connected = net_name(net, name, sizeof(name)) == 2 || nets[net].pins > 1;
+        if (connected)
+            used[port] |= 1 << bit;
+
+        printf("    P%c%d  pin %-3.*s  %s\n", 'A' + port, bit, (int)p->num.len, p->num.s,
+               connected ? name : "not connected");
+    }
+
+    for (port = 0; port < 4; port++)
+        if (used[port])
+            printf("    P%c used 0x%02x\n", 'A' + port, used[port]);
+
+    if (!found)
+        fprintf(stderr, "netlist: no symbol %s\n", ref);
+    return found ? 0 : -1;
+}
+
+int main(int argc, char **argv)
+{
+    const char *ref = NULL;
+    int         c, status = 0;
+
+    while ((c = getopt(argc, argv, "p:")) != -1) {
+        switch (c) {
+            case 'p': ref = optarg; break;
+            default:  status = 2; break;
+        }
+    }
+
+    if (status || optind >= argc) {
+        fprintf(stderr, "usage: netlist [-p ref] schematic.kicad_sch ...\n");
+        return 2;
+    }
+
+    for (c = optind; c < argc; c++)
+        if (load(argv[c], c - optind) < 0)
+            return 1;
+
+    if (connect() < 0) {
+        fprintf(stderr, "netlist: out of memory\n");
+        return 1;
+    }
+
+    if (ref != NULL)
+        return print_pins(ref) < 0 ? 1 : 0;
+
+    print_netlist();
+    return 0;
+}
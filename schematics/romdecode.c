@@ -0,0 +1,252 @@
+/*
+ * romdecode.c
+ *
+ *  Check the ROM card chip enable decode against the memory map.
+ *
+ *  usage: romdecode [-n millions] [trace ...]
+ *
+ *  -n  random bus cycles to run for the throughput figure (default 64
+ *      million) when no trace is given
+ *
+ *  The decode in rom.kicad_sch is a 74LS138 (U2) and two gates of a
+ *  74LS08 (U3) driving the AT28C256 (U1) ^CE and ^OE together:
+ *
+ *      U2  A0..A2 = AD12..AD14, E3 = AD15, ^E2 = ph1, ^E1 = GND
+ *      U3  pin 11 = ^O5 & ^O6,  pin 8 = pin 11 & ^O7  -> U1 ^CE, ^OE
+ *
+ *  so the ROM is selected for $D000-$FFFF while ph1 is low. The gates are
+ *  evaluated bit-sliced, 64 bus cycles per 64-bit word: bit n of each
+ *  signal word belongs to cycle n. Each word of ^CE is compared with the
+ *  select line expected from the memory map table.
+ *
+ *  With no trace, every address is checked in both clock phases and then
+ *  random cycles are run to measure throughput. A trace is a file of
+ *  16-bit little endian addresses, one per bus cycle, such as written by
+ *  an emulator; each cycle is checked in both phases.
+ *
+ *  build: cc -O2 -o romdecode romdecode.c
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LANES           64
+
+typedef uint64_t slice_t;
+
+typedef struct
+{
+    uint16_t first;
+    uint16_t last;
+} range_t;
+
+// ranges the card answers, from the ROM card section of README.md
+static const range_t rom_map[] =
+{
+    { 0xd000, 0xffff },
+};
+
+#define RANGES          (sizeof(rom_map) / sizeof(rom_map[0]))
+
+static uint64_t checked, mismatches;
+
+// map_select() for ph1 low, one bit per address
+static uint64_t map_bits[0x10000 / 64];
+
+/*
+ * map_select()
+ *
+ *  Reference: 1 if the memory map selects the ROM for this cycle.
+ */
+static int map_select(uint16_t addr, int ph1)
+{
+    size_t i;
+
+    if (ph1)
+        return 0;
+    for (i = 0; i < RANGES; i++)
+        if (addr >= rom_map[i].first && addr <= rom_map[i].last)
+            return 1;
+    return 0;
+}
+
+/*
+ * decode()
+ *
+ *  Bit-sliced gate network. a[] holds AD0..AD15, one cycle per bit.
+ *  Returns ^CE, a 0 bit is a selected cycle.
+ */
+static slice_t decode(const slice_t a[16], slice_t ph1)
+{
+    slice_t e, o5, o6, o7, u3_11;
+
+    // 74LS138 enable: E3 & ^E2 & ^E1, with ^E1 tied low
+    e = a[15] & ~ph1;
+
+    // active low outputs, A2..A0 = AD14..AD12
+    o5 = ~(e &  a[14] & ~a[13] &  a[12]);
+    o6 = ~(e &  a[14] &  a[13] & ~a[12]);
+    o7 = ~(e &  a[14] &  a[13] &  a[12]);
+
+    // 74LS08 gates
+    u3_11 = o5 & o6;
+    return u3_11 & o7;
+}
+
+static void map_init(void)
+{
+    uint32_t addr;
+
+    for (addr = 0; addr < 0x10000; addr++)
+        if (map_select((uint16_t)addr, 0))
+            map_bits[addr / 64] |= (uint64_t)1 << (addr % 64);
+}
+
+/*
+ * transpose()
+ *
+ *  Spread 64 addresses into 16 bit slices.
+ */
+static void transpose(const uint16_t *addr, slice_t a[16])
+{
+    int     i, b;
+    slice_t bit;
+
+    memset(a, 0, 16 * sizeof(slice_t));
+    for (i = 0; i < LANES; i++)
+        for (b = 0, bit = (slice_t)1 << i; b < 16; b++)
+            a[b] |= (slice_t)-((addr[i] >> b) & 1) & bit;
+}
+
+static void report(const uint16_t *addr, int count, int ph1, slice_t ce, slice_t expect)
+{
+    slice_t diff = ~ce ^ expect;
+    int     i;
+
+    for (i = 0; i < count; i++)
+        if (((diff >> i) & 1) && mismatches++ < 10)
+            printf("  $%04X ph1=%d: decode %s, map %s\n", addr[i], ph1,
+                   (ce >> i) & 1 ? "off" : "selects", (expect >> i) & 1 ? "selects" : "off");
+}
+
+/*
+ * check_block()
+ *
+ *  Run up to 64 cycles through the decode in both clock phases and
+ *  compare with the memory map. Unused lanes are masked off.
+ */
+static void check_block(const uint16_t *addr, int count)
+{
+    slice_t a[16], ce0, ce1, expect = 0, used;
+    int     i;
+
+    transpose(addr, a);
+    for (i = 0; i < count; i++)
+        expect |= ((map_bits[addr[i] / 64] >> (addr[i] % 64)) & 1) << i;
+
+    // the map never selects while ph1 is high
+    ce0 = decode(a, 0);
+    ce1 = decode(a, ~(slice_t)0);
+
+    used = count == LANES ? ~(slice_t)0 : ((slice_t)1 << count) - 1;
+    if ((~ce0 ^ expect) & used)
+        report(addr, count, 0, ce0 | ~used, expect);
+    if (~ce1 & used)
+        report(addr, count, 1, ce1 | ~used, 0);
+
+    checked += 2 * count;
+}
+
+static double seconds(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int check_trace(const char *name)
+{
+    uint16_t       addr[LANES];
+    unsigned char  buf[2 * LANES];
+    size_t         got, i;
+    FILE          *in;
+    double         start;
+    uint64_t       before = checked;
+
+    if ((in = fopen(name, "rb")) == NULL) {
+        perror(name);
+        return -1;
+    }
+
+    start = seconds();
+    while ((got = fread(buf, 2, LANES, in)) > 0) {
+        for (i = 0; i < got; i++)
+            addr[i] = buf[2 * i] | buf[2 * i + 1] << 8;
+        check_block(addr, (int)got);
+    }
+    fclose(in);
+
+    printf("%s: %llu cycles checked, %.1f M/s\n", name,
+           (unsigned long long)(checked - before) / 2,
+           (checked - before) / 2 / (seconds() - start) / 1e6);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    uint16_t addr[LANES];
+    uint64_t n, millions = 64, state = 0x9e3779b97f4a7c15ULL;
+    double   start;
+    int      c, i, status = 0;
+
+    while ((c = getopt(argc, argv, "n:")) != -1) {
+        switch (c) {
+            case 'n': millions = strtoull(optarg, NULL, 0); break;
+            default:  status = 2; break;
+        }
+    }
+
+    if (status) {
+        fprintf(stderr, "usage: romdecode [-n millions] [trace ...]\n");
+        return 2;
+    }
+
+    map_init();
+
+    if (optind < argc) {
+        for (; optind < argc; optind++)
+            if (check_trace(argv[optind]) < 0)
+                return 2;
+    }
+    else {
+        // every address, both phases
+        for (n = 0; n < 0x10000; n += LANES) {
+            for (i = 0; i < LANES; i++)
+                addr[i] = (uint16_t)(n + i);
+            check_block(addr, LANES);
+        }
+        printf("all addresses: %llu cycles checked\n", (unsigned long long)checked / 2);
+
+        // throughput on random addresses
+        start = seconds();
+        for (n = 0; n < millions * 1000000; n += LANES) {
+            for (i = 0; i < LANES; i++) {
+                state ^= state << 13;
+                state ^= state >> 7;
+                state ^= state << 17;
+                addr[i] = (uint16_t)state;
+            }
+            check_block(addr, LANES);
+        }
+        printf("random: %llu cycles checked, %.1f M/s\n",
+               (unsigned long long)millions * 1000000, millions / (seconds() - start));
+    }
+
+    printf("%llu mismatches\n", (unsigned long long)mismatches);
+    return mismatches ? 1 : 0;
+}